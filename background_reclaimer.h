@@ -0,0 +1,111 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_BACKGROUND_RECLAIMER_H
+#define CACHINGPP_BACKGROUND_RECLAIMER_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include "cache.h"
+
+
+// Destroys removed values on its own thread, so expensive destructors
+// (large buffers going back to the OS) never run on the get() path.
+template <typename Key, typename Value>
+class BackgroundReclaimer
+{
+    using Removals = std::vector<RemovalNotification<Key, Value>>;
+
+public:
+    BackgroundReclaimer()
+            : queue_(),
+              stopped_(false),
+              reclaimed_(0)
+    {
+        worker_ = std::thread([this] ()
+                              {
+                                  reclaim_loop();
+                              });
+    }
+
+    BackgroundReclaimer(BackgroundReclaimer const&) = delete;
+    BackgroundReclaimer& operator=(BackgroundReclaimer const&) = delete;
+
+    ~BackgroundReclaimer()
+    {
+        {
+            std::lock_guard<std::mutex> lck {mtx_};
+            stopped_ = true;
+        }
+        cv_.notify_one();
+        worker_.join();
+    }
+
+    // a removal listener that runs next first and then takes the whole batch
+    RemovalListener<Key, Value> listener(RemovalListener<Key, Value> next = nullptr)
+    {
+        return [this, next] (Removals& removals)
+        {
+            if (next)
+            {
+                next(removals);
+            }
+            reclaim(std::move(removals));
+            removals.clear();
+        };
+    }
+
+    void reclaim(Removals&& removals)
+    {
+        {
+            std::lock_guard<std::mutex> lck {mtx_};
+            queue_.push_back(std::move(removals));
+        }
+        cv_.notify_one();
+    }
+
+    uint64_t get_reclaimed() const
+    {
+        return reclaimed_;
+    }
+
+private:
+    std::vector<Removals> queue_;
+    bool stopped_;
+    std::atomic<uint64_t> reclaimed_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread worker_;
+
+    void reclaim_loop()
+    {
+        std::vector<Removals> reclaimed;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lck {mtx_};
+                cv_.wait(lck, [this] ()
+                         {
+                             return stopped_ || !queue_.empty();
+                         });
+                if (stopped_ && queue_.empty())
+                {
+                    return;
+                }
+                reclaimed.swap(queue_);
+            }
+
+            for (auto const& removals : reclaimed)
+            {
+                reclaimed_ += removals.size();
+            }
+            reclaimed.clear();
+        }
+    }
+};
+
+
+#endif //CACHINGPP_BACKGROUND_RECLAIMER_H
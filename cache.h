@@ -10,13 +10,36 @@
 #include <list>
 #include <vector>
 #include <mutex>
+#include <functional>
+#include <algorithm>
+#include "node_pool.h"
+
+
+// the form a key is stored in; keys that may borrow their bytes overload it
+template <typename Key>
+Key const& persist_key(Key const& key)
+{
+    return key;
+}
+
+
+template <typename Key, typename Value>
+using InvalidationPredicate = std::function<bool (Key const&, Value const&)>;
 
 
 template <typename Key, typename Value, typename EntryAlloc>
 class BaseCache
 {
 public:
-    virtual Value get(Key key) = 0;
+    virtual ~BaseCache() = default;
+
+    virtual Value get(Key const& key) = 0;
+    // a hit counts as get() would, a miss neither loads nor admits the key
+    virtual bool find(Key const& key, Value& value) = 0;
+    virtual void put(Key const& key, Value value) = 0;
+    virtual bool erase(Key const& key) = 0;
+    virtual size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) = 0;
+    virtual void record_accesses(std::vector<Key> const& keys) = 0;
     virtual bool check_cache_presence(Key const& key) = 0;
     virtual uint64_t get_cache_misses() const = 0;
     virtual size_t size() = 0;
@@ -28,7 +51,7 @@ template <typename Key>
 class BaseCacheList
 {
 public:
-    virtual void push(Key) = 0;
+    virtual void push(Key const&) = 0;
     virtual void remove() = 0;
     virtual Key head() = 0;
     virtual size_t size() const = 0;
@@ -36,11 +59,23 @@ public:
 };
 
 
-template <typename Key>
+template <typename Key, typename Allocator = std::allocator<Key>>
 class LruList
 {
+    using ListAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Key>;
+    using ListIterator = typename std::list<Key, ListAllocator>::iterator;
+    using MapAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<
+            std::pair<const Key, ListIterator>>;
+
 public:
-    bool check_presence(Key key)
+    explicit
+    LruList(Allocator const& allocator = Allocator())
+            : list_(ListAllocator(allocator)),
+              map_(0, std::hash<Key>(), std::equal_to<Key>(), MapAllocator(allocator))
+    {
+    }
+
+    bool check_presence(Key const& key)
     {
         return map_.find(key) != map_.end();
     }
@@ -50,14 +85,29 @@ public:
         return map_.size();
     }
 
-    void make_mru(Key key)
+    // a known key keeps its node, only new keys are copied in
+    void make_mru(Key const& key)
     {
-        if (check_presence(key))
+        auto it = map_.find(key);
+        if (it != map_.end())
         {
-            list_.erase(map_.at(key));
+            list_.splice(list_.begin(), list_, it->second);
+            return;
         }
-        list_.push_front(key);
-        map_[key] = list_.begin();
+        list_.push_front(persist_key(key));
+        map_.emplace(list_.front(), list_.begin());
+    }
+
+    void make_lru(Key const& key)
+    {
+        auto it = map_.find(key);
+        if (it != map_.end())
+        {
+            list_.splice(list_.end(), list_, it->second);
+            return;
+        }
+        list_.push_back(persist_key(key));
+        map_.emplace(list_.back(), std::prev(list_.end()));
     }
 
     Key remove_lru()
@@ -68,41 +118,92 @@ public:
         return ret;
     }
 
-    void erase(Key key)
+    // removes the least recent key not matching skip, or the LRU key if the last max_skipped keys all match
+    template <typename Predicate>
+    Key remove_lru_skipping(Predicate skip, size_t max_skipped)
+    {
+        auto victim = std::prev(list_.end());
+        size_t skipped = 0;
+        for (auto it = list_.rbegin(); it != list_.rend() && skipped <= max_skipped; ++it, ++skipped)
+        {
+            if (!skip(*it))
+            {
+                victim = std::prev(it.base());
+                break;
+            }
+        }
+        auto ret = *victim;
+        map_.erase(ret);
+        list_.erase(victim);
+        return ret;
+    }
+
+    void erase(Key const& key)
     {
-        list_.erase(map_.at(key));
-        map_.erase(key);
+        auto it = map_.find(key);
+        list_.erase(it->second);
+        map_.erase(it);
     }
 
 private:
-    std::list<Key> list_;
-    std::unordered_map<Key, typename std::list<Key>::iterator> map_;
+    std::list<Key, ListAllocator> list_;
+    std::unordered_map<Key, ListIterator, std::hash<Key>, std::equal_to<Key>, MapAllocator> map_;
 };
 
 
-template <typename Key>
+template <typename Key, typename Allocator = std::allocator<Key>>
 class ClockList : BaseCacheList<Key>
 {
+    using ListAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Key>;
+
 public:
-    ClockList()
-            : list_(),
+    using Position = typename std::list<Key, ListAllocator>::iterator;
+
+    explicit
+    ClockList(Allocator const& allocator = Allocator())
+            : list_(ListAllocator(allocator)),
               clock_hand_(list_.begin())
     {
     }
 
-    void push(Key key) override
+    void push(Key const& key) override
+    {
+        insert(key);
+    }
+
+    Position insert(Key const& key)
+    {
+        return list_.insert(clock_hand_, persist_key(key));
+    }
+
+    void erase(Position position)
     {
-        list_.insert(clock_hand_, key);
+        if (position == clock_hand_)
+        {
+            remove();
+        }
+        else
+        {
+            list_.erase(position);
+        }
     }
 
+    // the hand steps back to the previous key, so the next advance lands right after the removed one
     void remove() override
     {
         clock_hand_ = list_.erase(clock_hand_);
-        advance_clock();
-        //if (clock_hand_ == list_.end())
-        //{
-        //    clock_hand_ = list_.begin();
-        //}
+        if (list_.empty())
+        {
+            clock_hand_ = list_.end();
+        }
+        else if (clock_hand_ == list_.begin())
+        {
+            clock_hand_ = std::prev(list_.end());
+        }
+        else
+        {
+            --clock_hand_;
+        }
     }
 
     Key head() override
@@ -124,20 +225,26 @@ public:
     }
 
 private:
-    std::list<Key> list_;
-    typename std::list<Key>::iterator clock_hand_;
+    std::list<Key, ListAllocator> list_;
+    typename std::list<Key, ListAllocator>::iterator clock_hand_;
 };
 
 
-template <typename Key>
+template <typename Key, typename Allocator = std::allocator<Key>>
 class SecondChanceList : BaseCacheList<Key>
 {
+    using ListAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Key>;
+
 public:
-    SecondChanceList() = default;
+    explicit
+    SecondChanceList(Allocator const& allocator = Allocator())
+            : inner_list_(ListAllocator(allocator))
+    {
+    }
 
-    void push(Key key) override
+    void push(Key const& key) override
     {
-        inner_list_.push_back(key);
+        inner_list_.push_back(persist_key(key));
     }
 
     void remove() override
@@ -159,43 +266,307 @@ public:
     {}
 
 private:
-    std::list<Key> inner_list_;
+    std::list<Key, ListAllocator> inner_list_;
 };
 
 
-template <typename Key, typename Value, typename EntryAlloc>
+enum class RemovalCause
+{
+    CAPACITY,
+    EXPIRED,
+    EXPLICIT
+};
+
+template <typename Key, typename Value>
+struct RemovalNotification
+{
+    Key key;
+    Value value;
+    RemovalCause cause;
+};
+
+// receives removed entries after the cache lock is released, values may be moved out
+template <typename Key, typename Value>
+using RemovalListener = std::function<void (std::vector<RemovalNotification<Key, Value>>&)>;
+
+
+// Removed entries wait here under the cache lock until a batch is full; the batch
+// is then handed to the listener and destroyed after the lock is released.
+// The emptied buffer comes back as the spare one, so batches reuse two buffers.
+template <typename Key, typename Value>
+class RemovalQueue
+{
+    using Removals = std::vector<RemovalNotification<Key, Value>>;
+
+public:
+    struct Batch
+    {
+        Removals removals;
+        RemovalListener<Key, Value> listener;
+        RemovalQueue* queue = nullptr;
+
+        void deliver()
+        {
+            if (listener && !removals.empty())
+            {
+                listener(removals);
+            }
+            if (queue)
+            {
+                removals.clear();
+                queue->recycle(removals);
+                queue = nullptr;
+            }
+        }
+    };
+
+    explicit
+    RemovalQueue(size_t batch_size = 64)
+            : pending_(),
+              spare_(),
+              listener_(),
+              batch_size_(batch_size)
+    {
+    }
+
+    void push(Key const& key, Value&& value, RemovalCause cause)
+    {
+        pending_.push_back({key, std::move(value), cause});
+        if (batch_size_ == 0 && listener_)
+        {
+            listener_(pending_);
+            pending_.clear();
+        }
+    }
+
+    // a zero batch_size hands each removal to the listener under the cache lock, before the key can be missed
+    void set_listener(RemovalListener<Key, Value> listener, size_t batch_size)
+    {
+        listener_ = std::move(listener);
+        batch_size_ = batch_size;
+    }
+
+    void take_batch(Batch& batch, bool force = false)
+    {
+        if (!pending_.empty() && (pending_.size() >= batch_size_ || force))
+        {
+            batch.removals.swap(pending_);
+            batch.listener = listener_;
+            batch.queue = this;
+            std::lock_guard<std::mutex> lck {spare_mtx_};
+            pending_.swap(spare_);
+        }
+    }
+
+private:
+    Removals pending_;
+    Removals spare_;            // empty, guarded by spare_mtx_ as batches are recycled outside the cache lock
+    RemovalListener<Key, Value> listener_;
+    size_t batch_size_;
+    std::mutex spare_mtx_;
+
+    // listeners may keep the buffer, whatever comes back with more room than the spare replaces it
+    void recycle(Removals& removals)
+    {
+        std::lock_guard<std::mutex> lck {spare_mtx_};
+        if (removals.capacity() > spare_.capacity())
+        {
+            spare_.swap(removals);
+        }
+    }
+};
+
+// called on demand misses and on first hits to prefetched entries
+template <typename Key>
+using MissHandler = std::function<void (Key const&)>;
+
+
+template <typename Key, typename Value, typename EntryAlloc, typename NodeStorage = HeapNodes>
 class LruCache : public BaseCache<Key, Value, EntryAlloc>
 {
+    struct Entry
+    {
+        bool prefetched;
+        Value value;
+    };
+
+    using KeyAllocator = typename NodeStorage::template Allocator<Key>;
+    using DataAllocator = typename NodeStorage::template Allocator<std::pair<const Key, Entry>>;
+
+    // list node, index node and data node per entry
+    static constexpr size_t ENTRY_BYTES = 3 * sizeof(Key) + sizeof(Entry) + 5 * sizeof(void*);
+
+    static const size_t MAX_SKIPPED_PREFETCHED = 64;
+
 public:
     explicit
     LruCache(size_t cache_size)
-            : cache_list_(),
-              data_(),
+            : LruCache(cache_size, EntryAlloc())
+    {}
+
+    LruCache(size_t cache_size, EntryAlloc entry_alloc)
+            : nodes_(cache_size * ENTRY_BYTES),
+              cache_list_(nodes_.template allocator<Key>()),
+              data_(cache_size, std::hash<Key>(), std::equal_to<Key>(),
+                    nodes_.template allocator<std::pair<const Key, Entry>>()),
+              entry_alloc_(std::move(entry_alloc)),
               cache_misses_(0),
-              entry_alloc_(),
+              prefetch_hits_(0),
               cache_size_(cache_size)
     {}
 
-    Value get(Key key) override
+    Value get(Key const& key) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        Value value = get_value(key, removed);
+        removed.deliver();
+        return value;
+    }
+
+    bool find(Key const& key, Value& value) override
     {
         std::lock_guard<std::mutex> lck {mtx};
-        if (!check_cache_presence(key))
+        auto it = data_.find(key);
+        if (it == data_.end())
         {
             ++cache_misses_;
-            if (cache_list_.size() == cache_size_)
+            return false;
+        }
+        record_hit(it);
+        value = it->second.value;
+        return true;
+    }
+
+    void put(Key const& key, Value value) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        {
+            std::lock_guard<std::mutex> lck {mtx};
+            auto it = data_.find(key);
+            if (it != data_.end())
+            {
+                // the old value leaves with the argument, after the lock is released
+                std::swap(it->second.value, value);
+                it->second.prefetched = false;
+            }
+            else
             {
-                auto removed_key = cache_list_.remove_lru();
-                data_.erase(removed_key);
+                if (cache_list_.size() == cache_size_)
+                {
+                    remove_entry(remove_victim());
+                }
+                it = data_.emplace(persist_key(key), Entry{false, std::move(value)}).first;
             }
-            data_[key] = entry_alloc_(key);
-            cache_list_.make_mru(key);
+            cache_list_.make_mru(it->first);
+            removals_.take_batch(removed);
         }
-        else
+        removed.deliver();
+    }
+
+    bool erase(Key const& key) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        bool erased = false;
+        {
+            std::lock_guard<std::mutex> lck {mtx};
+            auto it = data_.find(key);
+            if (it != data_.end())
+            {
+                drop_entry(it);
+                erased = true;
+            }
+            removals_.take_batch(removed, erased);
+        }
+        removed.deliver();
+        return erased;
+    }
+
+    size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        size_t invalidated = 0;
+        {
+            std::lock_guard<std::mutex> lck {mtx};
+            for (auto it = data_.begin(); it != data_.end();)
+            {
+                auto next = std::next(it);
+                if (predicate(it->first, it->second.value))
+                {
+                    drop_entry(it);
+                    ++invalidated;
+                }
+                it = next;
+            }
+            removals_.take_batch(removed, invalidated != 0);
+        }
+        removed.deliver();
+        return invalidated;
+    }
+
+    // prefetched entries go to the LRU end, see remove_victim() for how long they stay there unused
+    size_t insert_prefetched(std::vector<std::pair<Key, Value>> const& entries)
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        size_t inserted = 0;
         {
-            cache_list_.make_mru(key);
+            std::lock_guard<std::mutex> lck {mtx};
+            for (auto const& prefetched : entries)
+            {
+                if (check_cache_presence(prefetched.first))
+                {
+                    continue;
+                }
+                if (cache_list_.size() == cache_size_)
+                {
+                    remove_entry(remove_victim());
+                }
+                auto it = data_.emplace(persist_key(prefetched.first), Entry{true, prefetched.second}).first;
+                cache_list_.make_lru(it->first);
+                ++inserted;
+            }
+            removals_.take_batch(removed);
         }
+        removed.deliver();
+        return inserted;
+    }
 
-        return data_.at(key);
+    // loads absent keys through EntryAlloc under a single lock, as misses of get() that nobody waits for
+    size_t load_all(std::vector<Key> const& keys)
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        size_t loaded = 0;
+        {
+            std::lock_guard<std::mutex> lck {mtx};
+            for (auto const& key : keys)
+            {
+                if (check_cache_presence(key))
+                {
+                    continue;
+                }
+                if (cache_list_.size() == cache_size_)
+                {
+                    remove_entry(remove_victim());
+                }
+                auto it = data_.emplace(persist_key(key), Entry{false, entry_alloc_(key)}).first;
+                cache_list_.make_mru(it->first);
+                ++loaded;
+            }
+            removals_.take_batch(removed);
+        }
+        removed.deliver();
+        return loaded;
+    }
+
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        std::lock_guard<std::mutex> lck {mtx};
+        for (auto const& key : keys)
+        {
+            if (check_cache_presence(key))
+            {
+                cache_list_.make_mru(key);
+            }
+        }
     }
 
     bool check_cache_presence(Key const & key) override
@@ -218,77 +589,313 @@ public:
         return "LRU";
     }
 
+    uint64_t get_prefetch_hits() const
+    {
+        return prefetch_hits_;
+    }
+
+    void set_removal_listener(RemovalListener<Key, Value> listener, size_t batch_size = 64)
+    {
+        std::lock_guard<std::mutex> lck {mtx};
+        removals_.set_listener(std::move(listener), batch_size);
+    }
+
+    // delivers removals still waiting for a full batch
+    void flush_removals()
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        {
+            std::lock_guard<std::mutex> lck {mtx};
+            removals_.take_batch(removed, true);
+        }
+        removed.deliver();
+    }
+
+    void set_miss_handler(MissHandler<Key> handler)
+    {
+        std::lock_guard<std::mutex> lck {mtx};
+        miss_handler_ = std::move(handler);
+    }
+
+    NodeStorage& get_node_storage()
+    {
+        return nodes_;
+    }
+
 private:
-    LruList<Key> cache_list_;
-    std::unordered_map<Key, Value> data_;
+    NodeStorage nodes_;
+    LruList<Key, KeyAllocator> cache_list_;
+    std::unordered_map<Key, Entry, std::hash<Key>, std::equal_to<Key>, DataAllocator> data_;
     EntryAlloc entry_alloc_;
+    RemovalQueue<Key, Value> removals_;
+    MissHandler<Key> miss_handler_;
 
     uint64_t cache_misses_;
+    uint64_t prefetch_hits_;
     size_t cache_size_;
 
     std::mutex mtx;
+
+    Value get_value(Key const& key, typename RemovalQueue<Key, Value>::Batch& removed)
+    {
+        std::lock_guard<std::mutex> lck {mtx};
+        auto it = data_.find(key);
+        if (it == data_.end())
+        {
+            ++cache_misses_;
+            if (cache_list_.size() == cache_size_)
+            {
+                remove_entry(remove_victim());
+            }
+            it = data_.emplace(persist_key(key), Entry{false, entry_alloc_(key)}).first;
+            cache_list_.make_mru(it->first);
+            if (miss_handler_)
+            {
+                miss_handler_(key);
+            }
+        }
+        else
+        {
+            record_hit(it);
+        }
+
+        removals_.take_batch(removed);
+        return it->second.value;
+    }
+
+    void record_hit(typename decltype(data_)::iterator it)
+    {
+        cache_list_.make_mru(it->first);
+        auto & entry = it->second;
+        if (entry.prefetched)
+        {
+            entry.prefetched = false;
+            ++prefetch_hits_;
+            if (miss_handler_)
+            {
+                miss_handler_(it->first);
+            }
+        }
+    }
+
+    // Unused prefetched entries wait at the LRU end, where they would be the next victims.
+    // Up to MAX_SKIPPED_PREFETCHED of them are passed over, beyond that the oldest one goes.
+    Key remove_victim()
+    {
+        return cache_list_.remove_lru_skipping([this] (Key const& key)
+                                               {
+                                                   return data_.at(key).prefetched;
+                                               }, MAX_SKIPPED_PREFETCHED);
+    }
+
+    void remove_entry(Key const& removed_key)
+    {
+        removals_.push(removed_key, std::move(data_.at(removed_key).value), RemovalCause::CAPACITY);
+        data_.erase(removed_key);
+    }
+
+    void drop_entry(typename decltype(data_)::iterator it)
+    {
+        cache_list_.erase(it->first);
+        removals_.push(it->first, std::move(it->second.value), RemovalCause::EXPLICIT);
+        data_.erase(it);
+    }
 };
 
 
-template<typename Key, typename Value, typename EntryAlloc>
+template<typename Key, typename Value, typename EntryAlloc, typename NodeStorage = HeapNodes>
 class CarCache : public BaseCache<Key, Value, EntryAlloc>
 {
+    using KeyAllocator = typename NodeStorage::template Allocator<Key>;
+
+    // history entries keep no value, they live in the history lists only
     struct Entry
     {
         int access_bit;
-        bool is_history;
+        bool prefetched;
+        bool is_frequent;
+        typename ClockList<Key, KeyAllocator>::Position position;
         Value value;
     };
 
+    using DataAllocator = typename NodeStorage::template Allocator<std::pair<const Key, Entry>>;
+
+    // clock or history node, history index node and data node per entry
+    static constexpr size_t ENTRY_BYTES = 3 * sizeof(Key) + sizeof(Entry) + 5 * sizeof(void*);
+
 public:
 
     explicit
     CarCache(size_t capacity)
-            : capacity_(capacity),
-              entry_alloc_(),
+            : CarCache(capacity, EntryAlloc())
+    {
+    }
+
+    CarCache(size_t capacity, EntryAlloc entry_alloc)
+            : nodes_(capacity * ENTRY_BYTES),
+              capacity_(capacity),
+              entry_alloc_(std::move(entry_alloc)),
               cache_size_(capacity / 2),
-              cache_recency_(),
-              cache_frequency_(),
-              history_frequency_(),
-              history_recency_(),
+              cache_recency_(nodes_.template allocator<Key>()),
+              cache_frequency_(nodes_.template allocator<Key>()),
+              history_frequency_(nodes_.template allocator<Key>()),
+              history_recency_(nodes_.template allocator<Key>()),
               target_size_(0),
               cache_misses_(0),
-              data_map_()
+              prefetch_hits_(0),
+              data_map_(capacity, std::hash<Key>(), std::equal_to<Key>(),
+                        nodes_.template allocator<std::pair<const Key, Entry>>())
 //              f("log.log")
     {
     }
 
-    Value get(Key key) override
+    Value get(Key const& key) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        Value value = get_value(key, removed);
+        removed.deliver();
+        return value;
+    }
+
+    // the histories are not consulted, a key that is not resident is a plain miss
+    bool find(Key const& key, Value& value) override
     {
         std::lock_guard<std::mutex> lock_guard{mtx};
-        if (!check_cache_presence(key))
+        auto it = data_map_.find(key);
+        if (it == data_map_.end())
         {
-            handle_cache_miss(key);
+            ++cache_misses_;
+            return false;
         }
-        else
+        record_hit(it->first, it->second);
+        value = it->second.value;
+        return true;
+    }
+
+    void put(Key const& key, Value value) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
         {
-            data_map_[key].access_bit = true;
+            std::lock_guard<std::mutex> lock_guard{mtx};
+            auto it = data_map_.find(key);
+            if (it != data_map_.end())
+            {
+                // the old value leaves with the argument, after the lock is released
+                std::swap(it->second.value, value);
+                it->second.access_bit = true;
+                it->second.prefetched = false;
+            }
+            else
+            {
+                admit(key, std::move(value), false);
+            }
+            removals_.take_batch(removed);
         }
+        removed.deliver();
+    }
 
-//        f << "CAR: full size: " << size() << '\n';
-//        f << "CAR: recencyClock size: " << cache_recency_.size() << '\n';
-//        f << "CAR: frequencyClock size: " << cache_frequency_.size() << '\n';
-//        f << "CAR: recencyHistory size: " << history_recency_.size() << '\n';
-//        f << "CAR: frequencyHistory size: " << history_frequency_.size() << '\n';
+    // the history lists are left as they are, explicit removals say nothing about recency or frequency
+    bool erase(Key const& key) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        bool erased = false;
+        {
+            std::lock_guard<std::mutex> lock_guard{mtx};
+            auto it = data_map_.find(key);
+            if (it != data_map_.end())
+            {
+                drop_entry(it);
+                erased = true;
+            }
+            removals_.take_batch(removed, erased);
+        }
+        removed.deliver();
+        return erased;
+    }
 
-        return data_map_.at(key).value;
+    size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) override
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        size_t invalidated = 0;
+        {
+            std::lock_guard<std::mutex> lock_guard{mtx};
+            for (auto it = data_map_.begin(); it != data_map_.end();)
+            {
+                auto next = std::next(it);
+                if (predicate(it->first, it->second.value))
+                {
+                    drop_entry(it);
+                    ++invalidated;
+                }
+                it = next;
+            }
+            removals_.take_batch(removed, invalidated != 0);
+        }
+        removed.deliver();
+        return invalidated;
     }
 
-    bool check_cache_presence(Key const & key) override
+    // prefetched entries go to T1 with a clear access bit; keys known to the cache or its history are skipped
+    size_t insert_prefetched(std::vector<std::pair<Key, Value>> const& entries)
     {
-        if (data_map_.find(key) != data_map_.end())
+        typename RemovalQueue<Key, Value>::Batch removed;
+        size_t inserted = 0;
         {
-            if (!data_map_.at(key).is_history)
+            std::lock_guard<std::mutex> lock_guard{mtx};
+            for (auto const& prefetched : entries)
             {
-                return true;
+                if (check_cache_presence(prefetched.first)
+                    || history_recency_.check_presence(prefetched.first)
+                    || history_frequency_.check_presence(prefetched.first))
+                {
+                    continue;
+                }
+                admit(prefetched.first, prefetched.second, true);
+                ++inserted;
             }
+            removals_.take_batch(removed);
         }
-        return false;
+        removed.deliver();
+        return inserted;
+    }
+
+    // loads absent keys through EntryAlloc under a single lock, as misses of get() that nobody waits for
+    size_t load_all(std::vector<Key> const& keys)
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        size_t loaded = 0;
+        {
+            std::lock_guard<std::mutex> lock_guard{mtx};
+            for (auto const& key : keys)
+            {
+                if (check_cache_presence(key))
+                {
+                    continue;
+                }
+                admit(key, entry_alloc_(key), false);
+                ++loaded;
+            }
+            removals_.take_batch(removed);
+        }
+        removed.deliver();
+        return loaded;
+    }
+
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        std::lock_guard<std::mutex> lock_guard{mtx};
+        for (auto const& key : keys)
+        {
+            if (check_cache_presence(key))
+            {
+                data_map_[key].access_bit = true;
+            }
+        }
+    }
+
+    bool check_cache_presence(Key const & key) override
+    {
+        return data_map_.find(key) != data_map_.end();
     }
 
     uint64_t get_cache_misses() const override
@@ -311,32 +918,115 @@ public:
         return "CAR";
     }
 
+    uint64_t get_prefetch_hits() const
+    {
+        return prefetch_hits_;
+    }
+
+    void set_removal_listener(RemovalListener<Key, Value> listener, size_t batch_size = 64)
+    {
+        std::lock_guard<std::mutex> lock_guard{mtx};
+        removals_.set_listener(std::move(listener), batch_size);
+    }
+
+    // delivers removals still waiting for a full batch
+    void flush_removals()
+    {
+        typename RemovalQueue<Key, Value>::Batch removed;
+        {
+            std::lock_guard<std::mutex> lock_guard{mtx};
+            removals_.take_batch(removed, true);
+        }
+        removed.deliver();
+    }
+
+    void set_miss_handler(MissHandler<Key> handler)
+    {
+        std::lock_guard<std::mutex> lock_guard{mtx};
+        miss_handler_ = std::move(handler);
+    }
+
+    NodeStorage& get_node_storage()
+    {
+        return nodes_;
+    }
+
 private:
 
+    NodeStorage nodes_;
     size_t capacity_;
     size_t cache_size_;
     size_t target_size_;
-    ClockList<Key> cache_recency_;
-    ClockList<Key> cache_frequency_;
-    LruList<Key> history_recency_;
-    LruList<Key> history_frequency_;
+    ClockList<Key, KeyAllocator> cache_recency_;
+    ClockList<Key, KeyAllocator> cache_frequency_;
+    LruList<Key, KeyAllocator> history_recency_;
+    LruList<Key, KeyAllocator> history_frequency_;
     EntryAlloc entry_alloc_;
+    RemovalQueue<Key, Value> removals_;
+    MissHandler<Key> miss_handler_;
     uint64_t cache_misses_;
+    uint64_t prefetch_hits_;
 
     std::mutex mtx;
 
-    std::unordered_map<Key, Entry> data_map_;
+    std::unordered_map<Key, Entry, std::hash<Key>, std::equal_to<Key>, DataAllocator> data_map_;
 
 //    std::ofstream f;
 
-    void remove_from_cache(ClockList<Key>& cache_list, LruList<Key>& history_list, Key const& victim_element)
+    Value get_value(Key const& key, typename RemovalQueue<Key, Value>::Batch& removed)
+    {
+        std::lock_guard<std::mutex> lock_guard{mtx};
+        auto it = data_map_.find(key);
+        if (it == data_map_.end())
+        {
+            it = handle_cache_miss(key);
+            if (miss_handler_)
+            {
+                miss_handler_(key);
+            }
+        }
+        else
+        {
+            record_hit(it->first, it->second);
+        }
+
+//        f << "CAR: full size: " << size() << '\n';
+//        f << "CAR: recencyClock size: " << cache_recency_.size() << '\n';
+//        f << "CAR: frequencyClock size: " << cache_frequency_.size() << '\n';
+//        f << "CAR: recencyHistory size: " << history_recency_.size() << '\n';
+//        f << "CAR: frequencyHistory size: " << history_frequency_.size() << '\n';
+
+        removals_.take_batch(removed);
+        return it->second.value;
+    }
+
+    // the first hit on a prefetched entry is its first reference, as a demand miss would be
+    void record_hit(Key const& key, Entry& entry)
+    {
+        if (entry.prefetched)
+        {
+            entry.prefetched = false;
+            ++prefetch_hits_;
+            if (miss_handler_)
+            {
+                miss_handler_(key);
+            }
+        }
+        else
+        {
+            entry.access_bit = true;
+        }
+    }
+
+    void remove_from_cache(ClockList<Key, KeyAllocator>& cache_list, LruList<Key, KeyAllocator>& history_list,
+                           Key const& victim_element)
     {
-        data_map_[victim_element].is_history = true;
+        remove_entry(victim_element);
         history_list.make_mru(victim_element);
         cache_list.remove();
     }
 
-    Key get_victim_element(ClockList<Key>& cache_list)
+    Key get_victim_element(ClockList<Key, KeyAllocator>& cache_list)
     {
         cache_list.advance_clock();
         return cache_list.head();
@@ -347,13 +1037,22 @@ private:
         Key victim_element = get_victim_element(cache_recency_);
         if (data_map_[victim_element].access_bit == 0)
         {
+            if (data_map_[victim_element].prefetched)
+            {
+                // a wasted prefetch says nothing about the workload, keep it out of the history
+                remove_entry(victim_element);
+                cache_recency_.remove();
+                return true;
+            }
             remove_from_cache(cache_recency_, history_recency_, victim_element);
             return true;
         }
         else
         {
-            data_map_[victim_element].access_bit = 0;
-            cache_frequency_.push(victim_element);
+            auto & entry = data_map_[victim_element];
+            entry.access_bit = 0;
+            entry.is_frequent = true;
+            entry.position = cache_frequency_.insert(victim_element);
             cache_recency_.remove();
         }
         return false;
@@ -395,42 +1094,66 @@ private:
         }
     }
 
-    void evict_from_history(Key key)
+    // Keeps |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c once key joins T1. Explicit
+    // removals leave the cache below c with full histories, so more than one ghost may have to go.
+    void evict_from_history(Key const& key)
     {
         if (!history_recency_.check_presence(key) && !history_frequency_.check_presence(key))
         {
-            if (cache_recency_.size() + history_recency_.size() == cache_size_)
+            while (cache_recency_.size() + history_recency_.size() >= cache_size_ && history_recency_.size() != 0)
             {
-                auto removed_key = history_recency_.remove_lru();
-                data_map_.erase(removed_key);
+                history_recency_.remove_lru();
             }
-            else if (cache_recency_.size() + cache_frequency_.size()
-                     + history_recency_.size() + history_frequency_.size() == capacity_)
+            while (cache_recency_.size() + cache_frequency_.size()
+                   + history_recency_.size() + history_frequency_.size() >= capacity_
+                   && history_frequency_.size() != 0)
             {
-                auto removed_key = history_frequency_.remove_lru();
-                data_map_.erase(removed_key);
+                history_frequency_.remove_lru();
             }
         }
     }
 
-    void replace(Key key)
+    void remove_entry(Key const& victim_element)
+    {
+        removals_.push(victim_element, std::move(data_map_.at(victim_element).value), RemovalCause::CAPACITY);
+        data_map_.erase(victim_element);
+    }
+
+    void drop_entry(typename decltype(data_map_)::iterator it)
+    {
+        (it->second.is_frequent ? cache_frequency_ : cache_recency_).erase(it->second.position);
+        removals_.push(it->first, std::move(it->second.value), RemovalCause::EXPLICIT);
+        data_map_.erase(it);
+    }
+
+    void replace(Key const& key)
     {
         evict_entry_from_cache();
         evict_from_history(key);
     }
 
-    Value handle_cache_miss(Key key)
+    typename decltype(data_map_)::iterator handle_cache_miss(Key const& key)
+    {
+        ++cache_misses_;
+        return admit(key, entry_alloc_(key), false);
+    }
+
+    typename decltype(data_map_)::iterator admit(Key const& key, Value value, bool prefetched)
     {
         if (cache_frequency_.size() + cache_recency_.size() == cache_size_)
         {
             replace(key);
         }
+        else
+        {
+            evict_from_history(key);
+        }
 
+        Key stored_key = persist_key(key);
         if (!history_frequency_.check_presence(key) && !history_recency_.check_presence(key))
         {
-            data_map_.insert({key, {0, false, entry_alloc_(key)}});
-            ++cache_misses_;
-            cache_recency_.push(key);
+            return data_map_.insert({stored_key, {0, prefetched, false, cache_recency_.insert(stored_key),
+                                                  std::move(value)}}).first;
         }
         else
         {
@@ -445,9 +1168,8 @@ private:
                 history_frequency_.erase(key);
             }
 
-            data_map_[key].access_bit = 0;
-            data_map_[key].is_history = false;
-            cache_frequency_.push(key);
+            return data_map_.insert({stored_key, {0, prefetched, true, cache_frequency_.insert(stored_key),
+                                                  std::move(value)}}).first;
         }
     }
 
@@ -460,7 +1182,8 @@ private:
     void decrease_recency_cache()
     {
         const unsigned long long growth_factor = history_recency_.size() / history_frequency_.size();
-        target_size_ = std::max(target_size_ - std::max(1ULL, growth_factor), 0ULL);
+        const unsigned long long decrease = std::max(1ULL, growth_factor);
+        target_size_ = target_size_ > decrease ? target_size_ - decrease : 0;
     }
 };
 
@@ -495,7 +1218,7 @@ public:
     {
     }
 
-    Value get(Key key) override
+    Value get(Key const& key) override
     {
         if (!check_cache_presence(key))
         {
@@ -509,6 +1232,17 @@ public:
         return data_map_[key].value;
     }
 
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        for (auto const& key : keys)
+        {
+            if (check_cache_presence(key))
+            {
+                data_map_[key].access_bit = true;
+            }
+        }
+    }
+
     bool check_cache_presence(Key const & key) const override
     {
         if (data_map_.find(key) != data_map_.end())
@@ -0,0 +1,65 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_COMMAND_LINE_H
+#define CACHINGPP_COMMAND_LINE_H
+
+
+#include <iostream>
+#include <string>
+#include <map>
+
+
+// "--name value" and "--name=value" arguments over a map of defaults; unknown names are errors
+inline bool parse_options(int argc, char** argv, std::map<std::string, std::string>& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument.compare(0, 2, "--") != 0)
+        {
+            std::cerr << "unexpected argument " << argument << "\n";
+            return false;
+        }
+
+        std::string name = argument.substr(2);
+        std::string value;
+        auto equals = name.find('=');
+        if (equals != std::string::npos)
+        {
+            value = name.substr(equals + 1);
+            name.resize(equals);
+        }
+        else if (i + 1 < argc)
+        {
+            value = argv[++i];
+        }
+        else
+        {
+            std::cerr << "missing value for --" << name << "\n";
+            return false;
+        }
+
+        auto option = options.find(name);
+        if (option == options.end())
+        {
+            std::cerr << "unknown option --" << name << "\n";
+            return false;
+        }
+        option->second = value;
+    }
+    return true;
+}
+
+inline void print_usage(char const* program, std::map<std::string, std::string> const& options)
+{
+    std::cerr << "usage: " << program << " [--option value]...\noptions and defaults:\n";
+    for (auto const& option : options)
+    {
+        std::cerr << "  --" << option.first << " " << (option.second.empty() ? "\"\"" : option.second) << "\n";
+    }
+}
+
+
+#endif //CACHINGPP_COMMAND_LINE_H
@@ -0,0 +1,271 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_FRONT_CACHE_H
+#define CACHINGPP_FRONT_CACHE_H
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include "cache.h"
+
+
+// Per-thread set-associative cache of immutable values in front of any BaseCache.
+// Hits touch only thread-local memory; the backing policy learns about them from
+// sampled batches passed to record_accesses. Lines remember the epoch of their set
+// when they were filled, bumping a set's epoch drops that set in every thread.
+template <typename Key, typename Value, typename EntryAlloc, size_t Sets = 1024, size_t Ways = 4>
+class FrontCache : public BaseCache<Key, Value, EntryAlloc>
+{
+    static_assert((Sets & (Sets - 1)) == 0, "FrontCache sets count must be a power of two");
+
+    struct Line
+    {
+        uint64_t epoch;         // 0 for an empty line
+        Key key;
+        Value value;
+    };
+
+    struct Set
+    {
+        Line lines[Ways];
+        size_t next_victim;
+    };
+
+    struct Table
+    {
+        Set sets[Sets];
+        size_t next_swept;
+        size_t hits_until_sample;
+        std::vector<Key> sampled_hits;
+    };
+
+public:
+    using Backing = BaseCache<Key, Value, EntryAlloc>;
+
+    explicit
+    FrontCache(std::unique_ptr<Backing> backing, size_t sample_period = 16, size_t forward_batch_size = 64)
+            : backing_(std::move(backing)),
+              instance_id_(++instances_count_),
+              sample_period_(sample_period),
+              forward_batch_size_(forward_batch_size)
+    {
+        for (auto & epoch : set_epochs_)
+        {
+            epoch = 1;
+        }
+    }
+
+    Value get(Key const& key) override
+    {
+        Table& table = local_table();
+        size_t index = set_index(key);
+        uint64_t epoch = set_epochs_[index].load(std::memory_order_acquire);
+        Set& set = table.sets[index];
+        sweep(table);
+        if (Line* line = find_line(set, epoch, key))
+        {
+            record_hit(table, line->key);
+            return line->value;
+        }
+
+        Value value = backing_->get(key);
+        fill(set, epoch, key, value);
+        return value;
+    }
+
+    bool find(Key const& key, Value& value) override
+    {
+        Table& table = local_table();
+        size_t index = set_index(key);
+        uint64_t epoch = set_epochs_[index].load(std::memory_order_acquire);
+        Set& set = table.sets[index];
+        sweep(table);
+        if (Line* line = find_line(set, epoch, key))
+        {
+            record_hit(table, line->key);
+            value = line->value;
+            return true;
+        }
+
+        if (!backing_->find(key, value))
+        {
+            return false;
+        }
+        fill(set, epoch, key, value);
+        return true;
+    }
+
+    // writes go to the backing cache first, then every thread drops the key's set
+    void put(Key const& key, Value value) override
+    {
+        backing_->put(key, std::move(value));
+        set_epochs_[set_index(key)].fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    bool erase(Key const& key) override
+    {
+        bool erased = backing_->erase(key);
+        set_epochs_[set_index(key)].fetch_add(1, std::memory_order_acq_rel);
+        return erased;
+    }
+
+    size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) override
+    {
+        size_t invalidated = backing_->invalidate_if(predicate);
+        invalidate_all();
+        return invalidated;
+    }
+
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        backing_->record_accesses(keys);
+    }
+
+    bool check_cache_presence(Key const& key) override
+    {
+        return backing_->check_cache_presence(key);
+    }
+
+    uint64_t get_cache_misses() const override
+    {
+        return backing_->get_cache_misses();
+    }
+
+    size_t size() override
+    {
+        return backing_->size();
+    }
+
+    std::string name() const override
+    {
+        return "Front+" + backing_->name();
+    }
+
+    void invalidate_all()
+    {
+        for (auto & epoch : set_epochs_)
+        {
+            epoch.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+
+private:
+    std::unique_ptr<Backing> backing_;
+    uint64_t instance_id_;
+    std::atomic<uint64_t> set_epochs_[Sets];
+    size_t sample_period_;
+    size_t forward_batch_size_;
+    std::vector<std::unique_ptr<Table>> tables_;
+    std::mutex tables_mtx_;
+
+    static std::atomic<uint64_t> instances_count_;
+
+    // Tables belong to the instance and go with it, threads only keep pointers to them.
+    // Ids are never reused, so pointers left behind by destroyed instances are never followed.
+    Table& local_table()
+    {
+        static thread_local uint64_t last_instance_id = 0;
+        static thread_local Table* last_table = nullptr;
+        if (last_instance_id == instance_id_)
+        {
+            return *last_table;
+        }
+
+        static thread_local std::unordered_map<uint64_t, Table*> tables;
+        auto & table = tables[instance_id_];
+        if (!table)
+        {
+            std::unique_ptr<Table> created(new Table());
+            created->hits_until_sample = sample_period_;
+            created->sampled_hits.reserve(forward_batch_size_);
+            table = created.get();
+
+            std::lock_guard<std::mutex> lck {tables_mtx_};
+            tables_.push_back(std::move(created));
+        }
+        last_instance_id = instance_id_;
+        last_table = table;
+        return *table;
+    }
+
+    static size_t set_index(Key const& key)
+    {
+        return std::hash<Key>()(key) & (Sets - 1);
+    }
+
+    // lines filled in an older epoch let go of their values on the way
+    Line* find_line(Set& set, uint64_t epoch, Key const& key)
+    {
+        Line* found = nullptr;
+        for (auto & line : set.lines)
+        {
+            if (line.epoch == epoch)
+            {
+                if (line.key == key)
+                {
+                    found = &line;
+                }
+            }
+            else if (line.epoch != 0)
+            {
+                release(line);
+            }
+        }
+        return found;
+    }
+
+    // one more set per lookup, so values of invalidated lines nobody looks up are released as well
+    void sweep(Table& table)
+    {
+        size_t index = table.next_swept;
+        table.next_swept = (index + 1) & (Sets - 1);
+        uint64_t epoch = set_epochs_[index].load(std::memory_order_relaxed);
+        for (auto & line : table.sets[index].lines)
+        {
+            if (line.epoch != 0 && line.epoch != epoch)
+            {
+                release(line);
+            }
+        }
+    }
+
+    // epoch is the one seen before the backing cache was asked, a write since then leaves the line stale
+    void fill(Set& set, uint64_t epoch, Key const& key, Value const& value)
+    {
+        Line& victim = set.lines[set.next_victim];
+        set.next_victim = (set.next_victim + 1) % Ways;
+        victim.epoch = epoch;
+        victim.key = persist_key(key);
+        victim.value = value;
+    }
+
+    static void release(Line& line)
+    {
+        line.epoch = 0;
+        line.value = Value();
+    }
+
+    void record_hit(Table& table, Key const& key)
+    {
+        if (--table.hits_until_sample != 0)
+        {
+            return;
+        }
+        table.hits_until_sample = sample_period_;
+        table.sampled_hits.push_back(key);
+        if (table.sampled_hits.size() >= forward_batch_size_)
+        {
+            backing_->record_accesses(table.sampled_hits);
+            table.sampled_hits.clear();
+        }
+    }
+};
+
+template <typename Key, typename Value, typename EntryAlloc, size_t Sets, size_t Ways>
+std::atomic<uint64_t> FrontCache<Key, Value, EntryAlloc, Sets, Ways>::instances_count_ {0};
+
+
+#endif //CACHINGPP_FRONT_CACHE_H
@@ -0,0 +1,140 @@
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include "heap_counter.h"
+
+
+// The whole set of global allocation functions is replaced, so every new form
+// is counted and every delete form frees with what allocated it. They live in
+// their own translation unit so they are never inlined into their callers.
+
+std::atomic<uint64_t> HEAP_ALLOCATIONS {0};
+
+namespace
+{
+    void* counted_alloc(size_t size) noexcept
+    {
+        ++HEAP_ALLOCATIONS;
+        return std::malloc(std::max(size, (size_t) 1));
+    }
+
+    void* counted_alloc(size_t size, std::align_val_t alignment) noexcept
+    {
+        ++HEAP_ALLOCATIONS;
+        void* p = nullptr;
+        if (::posix_memalign(&p, std::max((size_t) alignment, sizeof(void*)), std::max(size, (size_t) 1)) != 0)
+        {
+            return nullptr;
+        }
+        return p;
+    }
+
+    void* checked(void* p)
+    {
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+}
+
+void* operator new(size_t size)
+{
+    return checked(counted_alloc(size));
+}
+
+void* operator new[](size_t size)
+{
+    return checked(counted_alloc(size));
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return checked(counted_alloc(size, alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return checked(counted_alloc(size, alignment));
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+    return counted_alloc(size);
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+    return counted_alloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept
+{
+    return counted_alloc(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, std::nothrow_t const&) noexcept
+{
+    return counted_alloc(size, alignment);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::nothrow_t const&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::nothrow_t const&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t, std::nothrow_t const&) noexcept
+{
+    std::free(p);
+}
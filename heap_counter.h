@@ -0,0 +1,17 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_HEAP_COUNTER_H
+#define CACHINGPP_HEAP_COUNTER_H
+
+
+#include <atomic>
+#include <cstdint>
+
+
+// bumped by every replaced global operator new, see heap_counter.cpp
+extern std::atomic<uint64_t> HEAP_ALLOCATIONS;
+
+
+#endif //CACHINGPP_HEAP_COUNTER_H
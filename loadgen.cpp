@@ -0,0 +1,734 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "memcached_protocol.h"
+#include "command_line.h"
+
+
+// Closed-loop load generator for the memcached server: every connection keeps `depth`
+// requests in flight and sends the next one as soon as a response arrives. A get that
+// misses is followed by a set of the same key when fill is on.
+
+std::map<std::string, std::string> OPTIONS = {
+        {"host", "127.0.0.1"},
+        {"port", "11211"},
+        {"socket", ""},             // a Unix socket path replaces host and port
+        {"protocol", "text"},       // text (get/set) or meta (mg/ms)
+        {"threads", "2"},
+        {"connections", "16"},      // in total, spread over the threads
+        {"depth", "1"},             // pipelined requests per connection
+        {"duration", "10"},         // seconds, ignored when requests is set
+        {"requests", "0"},
+        {"warmup", "0"},            // seconds excluded from the report
+        {"trace", ""},              // keys to replay instead of the synthetic ones
+        {"trace_format", "text"},   // text, like the benchmark traces, or binary uint64
+        {"keys", "1000000"},
+        {"distribution", "zipf"},   // zipf or uniform
+        {"zipf", "0.99"},
+        {"set_ratio", "0"},
+        {"fill", "1"},
+        {"value_size", "100"},
+};
+
+using Clock = std::chrono::steady_clock;
+
+
+// Log-linear latency histogram in nanoseconds, 32 buckets per power of two (~3% error).
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 5;
+    static const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    LatencyHistogram()
+            : buckets_((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS, 0),
+              count_(0),
+              max_(0)
+    {}
+
+    void record(uint64_t nanos)
+    {
+        ++buckets_[bucket(nanos)];
+        ++count_;
+        max_ = std::max(max_, nanos);
+    }
+
+    void merge(LatencyHistogram const& other)
+    {
+        for (size_t i = 0; i < buckets_.size(); ++i)
+        {
+            buckets_[i] += other.buckets_[i];
+        }
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    // the highest latency of the bucket holding the given quantile
+    uint64_t percentile(double quantile) const
+    {
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(quantile * count_));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets_.size(); ++i)
+        {
+            seen += buckets_[i];
+            if (seen >= rank)
+            {
+                return std::min(highest(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t get_count() const
+    {
+        return count_;
+    }
+
+    uint64_t get_max() const
+    {
+        return max_;
+    }
+
+private:
+    std::vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t max_;
+
+    static size_t bucket(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS
+               + ((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t highest(size_t index)
+    {
+        if (index < SUB_BUCKETS)
+        {
+            return index;
+        }
+        int shift = index / SUB_BUCKETS - 1;
+        uint64_t lowest = (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+        return lowest + (uint64_t {1} << shift) - 1;
+    }
+};
+
+
+// Key numbers for the requests: a replayed trace, or zipf / uniform over [0, keys).
+class KeyStream
+{
+public:
+    KeyStream(std::vector<uint64_t> const* trace, std::vector<double> const* zipf_cdf,
+              uint64_t keys, size_t stream, size_t streams)
+            : trace_(trace),
+              zipf_cdf_(zipf_cdf),
+              uniform_(0, keys - 1),
+              position_(trace->empty() ? 0 : stream * trace->size() / streams),
+              generator_(stream + 1)
+    {}
+
+    uint64_t next()
+    {
+        if (!trace_->empty())
+        {
+            uint64_t key = (*trace_)[position_];
+            position_ = position_ + 1 == trace_->size() ? 0 : position_ + 1;
+            return key;
+        }
+        if (!zipf_cdf_->empty())
+        {
+            double point = std::generate_canonical<double, 53>(generator_);
+            return std::lower_bound(zipf_cdf_->begin(), zipf_cdf_->end(), point) - zipf_cdf_->begin();
+        }
+        return uniform_(generator_);
+    }
+
+    bool next_is_set(double set_ratio)
+    {
+        return set_ratio > 0 && std::generate_canonical<double, 53>(generator_) < set_ratio;
+    }
+
+private:
+    std::vector<uint64_t> const* trace_;
+    std::vector<double> const* zipf_cdf_;
+    std::uniform_int_distribution<uint64_t> uniform_;
+    size_t position_;
+    std::mt19937_64 generator_;
+};
+
+
+enum class Operation
+{
+    GET,
+    SET
+};
+
+enum class Outcome
+{
+    HIT,
+    MISS,
+    STORED,
+    FAILED
+};
+
+struct Request
+{
+    Operation operation;
+    uint64_t key;
+    Clock::time_point sent;
+};
+
+struct ClientConnection
+{
+    int fd;
+    std::vector<char> read_buffer;
+    size_t read_begin;
+    size_t read_end;
+    std::string write_buffer;
+    size_t written;
+    uint32_t events;
+    std::vector<Request> in_flight;     // ring of depth requests
+    size_t oldest;
+    size_t in_flight_count;
+};
+
+struct ThreadReport
+{
+    LatencyHistogram latencies;
+    uint64_t gets = 0;
+    uint64_t hits = 0;
+    uint64_t sets = 0;
+    uint64_t failures = 0;
+};
+
+
+int connect_to_server()
+{
+    int fd = -1;
+    if (!OPTIONS.at("socket").empty())
+    {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        std::string const& path = OPTIONS.at("socket");
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            std::string error = std::strerror(errno);
+            ::close(fd);
+            throw std::runtime_error("cannot connect to " + path + ": " + error);
+        }
+    }
+    else
+    {
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(std::stoul(OPTIONS.at("port")));
+        if (::inet_pton(AF_INET, OPTIONS.at("host").c_str(), &address.sin_addr) != 1)
+        {
+            throw std::invalid_argument("bad IPv4 address " + OPTIONS.at("host"));
+        }
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            std::string error = std::strerror(errno);
+            ::close(fd);
+            throw std::runtime_error("cannot connect to " + OPTIONS.at("host") + ":" + OPTIONS.at("port")
+                                     + ": " + error);
+        }
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    int flags = ::fcntl(fd, F_GETFL);
+    ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    return fd;
+}
+
+
+// bytes of the first response in input, 0 while it is incomplete
+size_t parse_response(std::string_view input, Operation operation, bool meta, Outcome& outcome)
+{
+    size_t line_length = find_line(input);
+    if (line_length == 0)
+    {
+        return 0;
+    }
+    std::string_view line = strip_line(input.substr(0, line_length));
+    TokenCursor tokens(line);
+    std::string_view status;
+    tokens.next(status);
+
+    if (operation == Operation::SET)
+    {
+        outcome = status == (meta ? "HD" : "STORED") ? Outcome::STORED : Outcome::FAILED;
+        return line_length;
+    }
+    if (status == (meta ? "EN" : "END"))
+    {
+        outcome = Outcome::MISS;
+        return line_length;
+    }
+    if (meta && status == "HD")
+    {
+        outcome = Outcome::HIT;
+        return line_length;
+    }
+
+    // "VA <size> ..." or "VALUE <key> <flags> <size> [<cas>]"
+    std::string_view token;
+    size_t size = 0;
+    bool value_header = meta ? status == "VA" && tokens.next(token)
+                             : status == "VALUE" && tokens.next(token) && tokens.next(token) && tokens.next(token);
+    if (!value_header || !parse_number(token, size))
+    {
+        outcome = Outcome::FAILED;
+        return line_length;
+    }
+
+    size_t trailer = meta ? 0 : std::strlen("END\r\n");
+    if (input.size() < line_length + size + 2 + trailer)
+    {
+        return 0;
+    }
+    outcome = meta || input.substr(line_length + size + 2, trailer) == "END\r\n" ? Outcome::HIT : Outcome::FAILED;
+    return line_length + size + 2 + trailer;
+}
+
+void append_request(std::string& out, Operation operation, uint64_t key, bool meta, std::string const& value)
+{
+    if (operation == Operation::GET)
+    {
+        out += meta ? "mg key:" : "get key:";
+        append_number(out, key);
+        out += meta ? " v\r\n" : "\r\n";
+        return;
+    }
+
+    out += meta ? "ms key:" : "set key:";
+    append_number(out, key);
+    out += meta ? " " : " 0 0 ";
+    append_number(out, value.size());
+    out += "\r\n";
+    out += value;
+    out += "\r\n";
+}
+
+
+class ClientThread
+{
+public:
+    ClientThread(size_t index, size_t threads, size_t connections, std::vector<uint64_t> const& trace,
+                 std::vector<double> const& zipf_cdf, std::string const& value)
+            : keys_(&trace, &zipf_cdf, std::stoull(OPTIONS.at("keys")), index, threads),
+              value_(value),
+              meta_(OPTIONS.at("protocol") == "meta"),
+              fill_(OPTIONS.at("fill") != "0"),
+              set_ratio_(std::stod(OPTIONS.at("set_ratio"))),
+              depth_(std::max<size_t>(1, std::stoull(OPTIONS.at("depth")))),
+              requests_left_(0),
+              request_limited_(false),
+              epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
+              connections_(connections)
+    {
+        uint64_t requests = std::stoull(OPTIONS.at("requests"));
+        if (requests != 0)
+        {
+            request_limited_ = true;
+            requests_left_ = requests / threads + (index < requests % threads ? 1 : 0);
+        }
+
+        for (auto & connection : connections_)
+        {
+            connection.fd = connect_to_server();
+            connection.read_buffer.resize(64 * 1024);
+            connection.read_begin = 0;
+            connection.read_end = 0;
+            connection.written = 0;
+            connection.events = EPOLLIN;
+            connection.in_flight.resize(depth_);
+            connection.oldest = 0;
+            connection.in_flight_count = 0;
+
+            epoll_event event {};
+            event.events = EPOLLIN;
+            event.data.ptr = &connection;
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection.fd, &event);
+        }
+    }
+
+    ~ClientThread()
+    {
+        for (auto & connection : connections_)
+        {
+            ::close(connection.fd);
+        }
+        ::close(epoll_fd_);
+    }
+
+    void run(Clock::time_point measure_from, Clock::time_point stop_at)
+    {
+        measure_from_ = measure_from;
+        stop_at_ = stop_at;
+
+        size_t in_flight = 0;
+        for (auto & connection : connections_)
+        {
+            while (connection.in_flight_count < depth_ && issue(connection, Clock::now()))
+            {
+                ++in_flight;
+            }
+            send(connection);
+        }
+
+        epoll_event events[64];
+        while (in_flight != 0)
+        {
+            int ready = ::epoll_wait(epoll_fd_, events, 64, 100);
+            if (ready < 0 && errno != EINTR)
+            {
+                throw std::runtime_error(std::string("epoll_wait: ") + std::strerror(errno));
+            }
+            for (int i = 0; i < ready; ++i)
+            {
+                auto & connection = *static_cast<ClientConnection*>(events[i].data.ptr);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    in_flight -= receive(connection);
+                }
+                send(connection);
+            }
+        }
+    }
+
+    ThreadReport const& get_report() const
+    {
+        return report_;
+    }
+
+private:
+    KeyStream keys_;
+    std::string const& value_;
+    bool meta_;
+    bool fill_;
+    double set_ratio_;
+    size_t depth_;
+    uint64_t requests_left_;
+    bool request_limited_;
+    Clock::time_point measure_from_;
+    Clock::time_point stop_at_;
+
+    int epoll_fd_;
+    std::vector<ClientConnection> connections_;
+    ThreadReport report_;
+
+    // queues the next request, false once the run is over; fill sets are always sent
+    bool issue(ClientConnection& connection, Clock::time_point now, bool fill = false, uint64_t fill_key = 0)
+    {
+        Request request {Operation::SET, fill_key, now};
+        if (!fill)
+        {
+            if (request_limited_ ? requests_left_ == 0 : now >= stop_at_)
+            {
+                return false;
+            }
+            if (request_limited_)
+            {
+                --requests_left_;
+            }
+            request.key = keys_.next();
+            request.operation = keys_.next_is_set(set_ratio_) ? Operation::SET : Operation::GET;
+        }
+        append_request(connection.write_buffer, request.operation, request.key, meta_, value_);
+        connection.in_flight[(connection.oldest + connection.in_flight_count) % depth_] = request;
+        ++connection.in_flight_count;
+        return true;
+    }
+
+    // reads and completes responses, returns how many requests left flight for good
+    size_t receive(ClientConnection& connection)
+    {
+        auto & buffer = connection.read_buffer;
+        if (connection.read_end == buffer.size())
+        {
+            if (connection.read_begin != 0)
+            {
+                std::memmove(buffer.data(), buffer.data() + connection.read_begin,
+                             connection.read_end - connection.read_begin);
+                connection.read_end -= connection.read_begin;
+                connection.read_begin = 0;
+            }
+            else
+            {
+                buffer.resize(buffer.size() * 2);
+            }
+        }
+
+        ssize_t received = ::recv(connection.fd, buffer.data() + connection.read_end,
+                                  buffer.size() - connection.read_end, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            throw std::runtime_error("connection closed by the server");
+        }
+        if (received < 0)
+        {
+            return 0;
+        }
+        connection.read_end += received;
+
+        size_t finished = 0;
+        auto now = Clock::now();
+        while (connection.in_flight_count != 0)
+        {
+            Request const request = connection.in_flight[connection.oldest];
+            std::string_view input(buffer.data() + connection.read_begin, connection.read_end - connection.read_begin);
+            Outcome outcome = Outcome::FAILED;
+            size_t consumed = parse_response(input, request.operation, meta_, outcome);
+            if (consumed == 0)
+            {
+                break;
+            }
+            connection.read_begin += consumed;
+            connection.oldest = (connection.oldest + 1) % depth_;
+            --connection.in_flight_count;
+
+            record(request, outcome, now);
+            if (!issue(connection, now, fill_ && outcome == Outcome::MISS, request.key))
+            {
+                ++finished;
+            }
+        }
+
+        if (connection.read_begin == connection.read_end)
+        {
+            connection.read_begin = 0;
+            connection.read_end = 0;
+        }
+        return finished;
+    }
+
+    void record(Request const& request, Outcome outcome, Clock::time_point now)
+    {
+        if (request.sent < measure_from_)
+        {
+            return;
+        }
+        report_.latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - request.sent).count());
+        if (request.operation == Operation::GET)
+        {
+            ++report_.gets;
+            report_.hits += outcome == Outcome::HIT;
+        }
+        else
+        {
+            ++report_.sets;
+        }
+        report_.failures += outcome == Outcome::FAILED;
+    }
+
+    void send(ClientConnection& connection)
+    {
+        auto & buffer = connection.write_buffer;
+        while (connection.written < buffer.size())
+        {
+            ssize_t sent = ::send(connection.fd, buffer.data() + connection.written,
+                                  buffer.size() - connection.written, MSG_NOSIGNAL);
+            if (sent > 0)
+            {
+                connection.written += sent;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if (errno != EINTR)
+            {
+                throw std::runtime_error("connection closed by the server");
+            }
+        }
+        if (connection.written == buffer.size())
+        {
+            buffer.clear();
+            connection.written = 0;
+        }
+
+        uint32_t wanted = connection.written < buffer.size() ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        if (wanted != connection.events)
+        {
+            epoll_event event {};
+            event.events = wanted;
+            event.data.ptr = &connection;
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.events = wanted;
+        }
+    }
+};
+
+
+std::vector<uint64_t> load_trace(std::string const& path, std::string const& format)
+{
+    std::vector<uint64_t> trace;
+    if (format == "binary")
+    {
+        std::ifstream fin(path, std::ios::binary);
+        uint64_t key = 0;
+        while (fin.read(reinterpret_cast<char*>(&key), sizeof(key)))
+        {
+            trace.push_back(key);
+        }
+    }
+    else
+    {
+        std::ifstream fin(path);
+        uint64_t key = 0;
+        while (fin >> key)
+        {
+            trace.push_back(key);
+        }
+    }
+    if (trace.empty())
+    {
+        throw std::runtime_error("no keys in trace " + path);
+    }
+    return trace;
+}
+
+std::vector<double> zipf_cdf(uint64_t keys, double exponent)
+{
+    std::vector<double> cdf(keys);
+    double total = 0;
+    for (uint64_t i = 0; i < keys; ++i)
+    {
+        total += 1.0 / std::pow(i + 1, exponent);
+        cdf[i] = total;
+    }
+    for (auto & point : cdf)
+    {
+        point /= total;
+    }
+    return cdf;
+}
+
+int main(int argc, char** argv)
+{
+    if (!parse_options(argc, argv, OPTIONS))
+    {
+        print_usage(argv[0], OPTIONS);
+        return 1;
+    }
+
+    try
+    {
+        std::vector<uint64_t> trace;
+        std::vector<double> cdf;
+        if (!OPTIONS.at("trace").empty())
+        {
+            trace = load_trace(OPTIONS.at("trace"), OPTIONS.at("trace_format"));
+        }
+        else if (OPTIONS.at("distribution") == "zipf")
+        {
+            cdf = zipf_cdf(std::stoull(OPTIONS.at("keys")), std::stod(OPTIONS.at("zipf")));
+        }
+        std::string value(std::stoull(OPTIONS.at("value_size")), 'x');
+
+        size_t threads_count = std::max<size_t>(1, std::stoull(OPTIONS.at("threads")));
+        size_t connections_count = std::max<size_t>(threads_count, std::stoull(OPTIONS.at("connections")));
+        std::vector<std::unique_ptr<ClientThread>> clients;
+        for (size_t i = 0; i < threads_count; ++i)
+        {
+            size_t connections = connections_count / threads_count + (i < connections_count % threads_count ? 1 : 0);
+            clients.emplace_back(new ClientThread(i, threads_count, connections, trace, cdf, value));
+        }
+
+        auto start = Clock::now();
+        auto measure_from = start + std::chrono::seconds(std::stoull(OPTIONS.at("warmup")));
+        auto stop_at = measure_from + std::chrono::seconds(std::stoull(OPTIONS.at("duration")));
+
+        std::vector<std::thread> threads;
+        std::atomic<bool> failed {false};
+        for (auto & client : clients)
+        {
+            ClientThread* running = client.get();
+            threads.emplace_back([running, measure_from, stop_at, &failed] ()
+                                 {
+                                     try
+                                     {
+                                         running->run(measure_from, stop_at);
+                                     }
+                                     catch (std::exception const& e)
+                                     {
+                                         std::cerr << e.what() << "\n";
+                                         failed = true;
+                                     }
+                                 });
+        }
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+        auto end = Clock::now();
+        if (failed)
+        {
+            return 1;
+        }
+
+        ThreadReport total;
+        for (auto const& client : clients)
+        {
+            auto const& report = client->get_report();
+            total.latencies.merge(report.latencies);
+            total.gets += report.gets;
+            total.hits += report.hits;
+            total.sets += report.sets;
+            total.failures += report.failures;
+        }
+
+        double seconds = std::chrono::duration<double>(end - std::max(start, measure_from)).count();
+        auto micros = [&total] (double quantile)
+        {
+            return total.latencies.percentile(quantile) / 1000.0;
+        };
+
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << OPTIONS.at("protocol") << " protocol, " << threads_count << " threads, "
+                  << connections_count << " connections, depth " << OPTIONS.at("depth") << "\n";
+        std::cout << "requests: " << total.latencies.get_count() << " in " << seconds << "s"
+                  << " throughput: " << total.latencies.get_count() / seconds << " req/s\n";
+        std::cout << "gets: " << total.gets << " hits: " << total.hits
+                  << " (" << (total.gets ? 100.0 * total.hits / total.gets : 0.0) << "%)"
+                  << " sets: " << total.sets << " failures: " << total.failures << "\n";
+        std::cout << "latency us:  p50 " << micros(0.5) << " p90 " << micros(0.9)
+                  << " p99 " << micros(0.99) << " p99.9 " << micros(0.999)
+                  << " max " << total.latencies.get_max() / 1000.0 << "\n";
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
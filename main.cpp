@@ -7,7 +7,21 @@
 #include <thread>
 #include <unordered_set>
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "cache.h"
+#include "tiered_cache.h"
+#include "front_cache.h"
+#include "prefetching_cache.h"
+#include "background_reclaimer.h"
+#include "write_back_cache.h"
+#include "string_key.h"
+#include "heap_counter.h"
 
 
 std::unordered_map<std::string, std::unordered_map<std::string, int>> SETTINGS = {
@@ -20,8 +34,26 @@ std::unordered_map<std::string, std::unordered_map<std::string, int>> SETTINGS =
                 {"threads", 5},
             },
         },
+        {
+            "tiered_tests", {
+                {"l1_size", 16 * 1024},
+                {"l2_segments", 16},
+                {"l2_segment_records", 8 * 1024},
+                {"demotion_batch", 256},
+                {"promotion_batch", 64},
+            },
+        },
 };
 
+size_t resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    statm >> total_pages >> resident_pages;
+    return resident_pages * sysconf(_SC_PAGESIZE);
+}
+
 struct A
 {
     uint64_t operator() (uint64_t key) const
@@ -31,6 +63,85 @@ struct A
     }
 };
 
+// mapped on its own, so destroying it always returns the pages to the OS
+class MappedBuffer
+{
+public:
+    MappedBuffer(size_t size, char fill)
+            : data_(static_cast<char*>(::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))),
+              size_(size)
+    {
+        if (data_ == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        std::memset(data_, fill, size_);
+    }
+
+    MappedBuffer(MappedBuffer const&) = delete;
+    MappedBuffer& operator=(MappedBuffer const&) = delete;
+
+    ~MappedBuffer()
+    {
+        ::munmap(data_, size_);
+    }
+
+    char front() const
+    {
+        return data_[0];
+    }
+
+private:
+    char* data_;
+    size_t size_;
+};
+
+using LargeValue = std::shared_ptr<MappedBuffer>;
+
+struct LargeValueAlloc
+{
+    LargeValue operator() (uint64_t key) const
+    {
+        return std::make_shared<MappedBuffer>(256 * 1024, (char) key);
+    }
+};
+
+struct KeyLength
+{
+    template <typename Key>
+    uint64_t operator() (Key const& key) const
+    {
+        return key.size();
+    }
+};
+
+std::mutex BACKEND_MTX;
+std::unordered_map<uint64_t, uint64_t> BACKEND;
+
+// keys never written read as themselves
+struct BackendReader
+{
+    uint64_t operator() (uint64_t key) const
+    {
+        std::lock_guard<std::mutex> lck {BACKEND_MTX};
+        auto it = BACKEND.find(key);
+        return it != BACKEND.end() ? it->second : key;
+    }
+};
+
+struct BackendWriter
+{
+    void operator() (std::vector<std::pair<uint64_t, uint64_t>> const& batch) const
+    {
+        std::lock_guard<std::mutex> lck {BACKEND_MTX};
+        for (auto const& entry : batch)
+        {
+            BACKEND[entry.first] = entry.second;
+        }
+    }
+};
+
 template <typename ChronoTimeSignature>
 inline ChronoTimeSignature measure_time(std::function<void (void)> const& lambda)
 {
@@ -41,12 +152,22 @@ inline ChronoTimeSignature measure_time(std::function<void (void)> const& lambda
 }
 
 void test_from_file(std::string const&);
+void tiered_test_from_file(std::string const&);
 void seq_test();
+void allocator_test();
+void reclamation_test();
+void write_back_test();
+void string_key_test();
 
 void run_tests()
 {
     test_from_file("/home/student/Documents/zipf_distribution_50M2.txt");
+    tiered_test_from_file("/home/student/Documents/zipf_distribution_50M2.txt");
     seq_test();
+    allocator_test();
+    reclamation_test();
+    write_back_test();
+    string_key_test();
     std::cout << "All tests OK" << std::endl;
 }
 
@@ -60,6 +181,20 @@ void seq_test()
         assert(cache->get(i) == i);
     }
 
+    for (size_t stride : {1, 3})
+    {
+        PrefetchingCache<uint64_t, uint64_t, A, CarCache> prefetching_cache(16384);
+        for (size_t i = 0; i < 40000; ++i)
+        {
+            assert(prefetching_cache.get(i * stride) == i * stride);
+        }
+        std::cout << prefetching_cache.name() << " stride " << stride << ":  "
+                  << cache->get_cache_misses() << " -> " << prefetching_cache.get_cache_misses() << " misses,"
+                  << " accuracy: " << prefetching_cache.get_prefetch_accuracy() * 100 << '%'
+                  << " coverage: " << prefetching_cache.get_prefetch_coverage() * 100 << '%'
+                  << "\n";
+    }
+
     std::cout << "sequential test finished\n";
 }
 
@@ -74,6 +209,8 @@ void test_from_file(std::string const& file_path)
     std::vector<std::unique_ptr<BaseCache<uint64_t, uint64_t, A>>> caches;
     caches.push_back(std::make_unique<CarCache<uint64_t, uint64_t, A>>(CACHE_SIZE));
     caches.push_back(std::make_unique<LruCache<uint64_t, uint64_t, A>>(CACHE_SIZE));
+    caches.push_back(std::make_unique<FrontCache<uint64_t, uint64_t, A>>(
+            std::make_unique<CarCache<uint64_t, uint64_t, A>>(CACHE_SIZE)));
 
     std::unordered_map<std::string, std::chrono::nanoseconds> times;
     for (auto const& cache : caches)
@@ -151,6 +288,280 @@ void test_from_file(std::string const& file_path)
     std::cout << "testing from file \"" << file_path << "\" finished\n";
 }
 
+template <template <typename, typename, typename...> class L1Policy>
+void run_tiered_queries(std::vector<uint64_t> const& queries)
+{
+    using Cache = TieredCache<uint64_t, uint64_t, A, L1Policy>;
+
+    auto current_settings = SETTINGS.at("tiered_tests");
+    Cache cache(current_settings.at("l1_size"), "/tmp/cachingpp_l2.log",
+                current_settings.at("l2_segments"), current_settings.at("l2_segment_records"),
+                current_settings.at("demotion_batch"), current_settings.at("promotion_batch"));
+
+    for (auto number : queries)
+    {
+        assert(number == cache.get(number));
+    }
+
+    const char* tier_names[] = {"L1", "L2", "backend"};
+    for (size_t i = 0; i < Cache::TIERS_COUNT; ++i)
+    {
+        auto tier = static_cast<typename Cache::Tier>(i);
+        auto hits = cache.get_tier_hits(tier);
+        std::cout << cache.name() << ' ' << tier_names[i] << ":  " << hits << ' '
+                  << (double) hits / queries.size() * 100 << '%'
+                  << " avg latency: " << (hits ? cache.get_tier_time(tier).count() / hits : 0) << "ns"
+                  << "\n";
+    }
+}
+
+// keys in [0, keys_count), key 0 being the most popular one
+std::vector<uint64_t> zipf_queries(size_t test_size, uint64_t keys_count, double exponent)
+{
+    std::vector<double> cdf(keys_count);
+    double sum = 0;
+    for (uint64_t i = 0; i < keys_count; ++i)
+    {
+        sum += 1 / std::pow(i + 1, exponent);
+        cdf[i] = sum;
+    }
+
+    std::mt19937 g{42};
+    std::uniform_real_distribution<double> distribution(0, sum);
+    std::vector<uint64_t> queries(test_size);
+    for (auto & number : queries)
+    {
+        number = std::lower_bound(cdf.begin(), cdf.end(), distribution(g)) - cdf.begin();
+    }
+    return queries;
+}
+
+void tiered_test_from_file(std::string const& file_path)
+{
+    std::cout << "tiered testing from file \"" << file_path << "\" started\n";
+
+    std::ifstream fin(file_path);
+    std::vector<uint64_t> queries;
+    uint64_t number = 0;
+    while (queries.size() < 10 * 1000 * 1000 && fin >> number)
+    {
+        queries.push_back(number);
+    }
+    if (queries.empty())
+    {
+        auto current_settings = SETTINGS.at("random_tests");
+        std::cout << "no queries in \"" << file_path << "\", using synthetic zipf keys\n";
+        queries = zipf_queries(current_settings.at("test_size"), current_settings.at("random_max"), 0.99);
+    }
+
+    run_tiered_queries<CarCache>(queries);
+    run_tiered_queries<LruCache>(queries);
+
+    std::cout << "tiered testing from file \"" << file_path << "\" finished\n";
+}
+
+uint64_t arena_allocations(HeapNodes const&)
+{
+    return 0;
+}
+
+template <HugePages Mode>
+uint64_t arena_allocations(PooledNodes<Mode> const& nodes)
+{
+    return nodes.arena.get_allocations();
+}
+
+template <typename Cache>
+void run_allocator_queries(std::string const& storage_name, size_t cache_size, std::vector<uint64_t> const& queries)
+{
+    auto rss_before = resident_bytes();
+    auto heap_allocations_before = HEAP_ALLOCATIONS.load();
+
+    Cache cache(cache_size);
+    auto duration = measure_time<std::chrono::milliseconds>(
+            [&cache, &queries] ()
+            {
+                for (auto number : queries)
+                {
+                    assert(number == cache.get(number));
+                }
+            });
+
+    std::cout << cache.name() << " " << storage_name << ":  " << duration.count() << "ms"
+              << " heap allocations: " << HEAP_ALLOCATIONS - heap_allocations_before
+              << " arena allocations: " << arena_allocations(cache.get_node_storage())
+              << " rss: +" << (resident_bytes() - rss_before) / 1024 << "KiB"
+              << "\n";
+}
+
+void allocator_test()
+{
+    std::cout << "allocator test started\n";
+
+    auto current_settings = SETTINGS.at("random_tests");
+    const size_t CACHE_SIZE = current_settings.at("cache_size");
+
+    std::mt19937 g{42};
+    std::uniform_int_distribution<uint64_t> distribution(current_settings.at("random_min"),
+                                                         current_settings.at("random_max"));
+    std::vector<uint64_t> queries(current_settings.at("test_size"));
+    for (auto & number : queries)
+    {
+        number = distribution(g);
+    }
+
+    run_allocator_queries<CarCache<uint64_t, uint64_t, A, HeapNodes>>("heap", CACHE_SIZE, queries);
+    run_allocator_queries<CarCache<uint64_t, uint64_t, A, PooledNodes<>>>("pool", CACHE_SIZE, queries);
+    run_allocator_queries<CarCache<uint64_t, uint64_t, A, PooledNodes<HugePages::EXPLICIT>>>("pool+hugetlb",
+                                                                                             CACHE_SIZE, queries);
+    run_allocator_queries<LruCache<uint64_t, uint64_t, A, HeapNodes>>("heap", CACHE_SIZE, queries);
+    run_allocator_queries<LruCache<uint64_t, uint64_t, A, PooledNodes<>>>("pool", CACHE_SIZE, queries);
+
+    std::cout << "allocator test finished\n";
+}
+
+std::chrono::nanoseconds thread_cpu_time()
+{
+    timespec time {};
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return std::chrono::seconds{time.tv_sec} + std::chrono::nanoseconds{time.tv_nsec};
+}
+
+// Values are built outside the timed part, which is put() evicting a value and destroying it. CPU time of
+// the calling thread is measured, a reclaimer sharing its core would show up in wall time anyway.
+void reclamation_test()
+{
+    std::cout << "reclamation test started\n";
+
+    const size_t CACHE_SIZE = 1024;
+    const size_t PUTS_COUNT = 20000;
+
+    for (bool background : {false, true})
+    {
+        BackgroundReclaimer<uint64_t, LargeValue> reclaimer;
+        LruCache<uint64_t, LargeValue, LargeValueAlloc> cache(CACHE_SIZE);
+        if (background)
+        {
+            cache.set_removal_listener(reclaimer.listener());
+        }
+
+        LargeValueAlloc alloc;
+        std::chrono::nanoseconds duration {0};
+        for (uint64_t key = 0; key < PUTS_COUNT; ++key)
+        {
+            LargeValue value = alloc(key);
+            if (key < CACHE_SIZE)
+            {
+                cache.put(key, std::move(value));
+                continue;
+            }
+            auto start_time = thread_cpu_time();
+            cache.put(key, std::move(value));
+            duration += thread_cpu_time() - start_time;
+        }
+        assert((char) (PUTS_COUNT - 1) == cache.get(PUTS_COUNT - 1)->front());
+
+        std::cout << cache.name() << (background ? " background reclamation:  " : " caller reclamation:  ")
+                  << duration.count() / (PUTS_COUNT - CACHE_SIZE) << "ns per evicting put"
+                  << "\n";
+    }
+
+    std::cout << "reclamation test finished\n";
+}
+
+void write_back_test()
+{
+    std::cout << "write-back test started\n";
+
+    std::mt19937 g{42};
+    std::geometric_distribution<uint64_t> distribution(0.005);
+    std::vector<uint64_t> queries(1000000);
+    for (auto & number : queries)
+    {
+        number = distribution(g);
+    }
+
+    for (auto flush_interval : {std::chrono::milliseconds{0}, std::chrono::milliseconds{10}})
+    {
+        BACKEND.clear();
+        std::unordered_map<uint64_t, uint64_t> written;
+        WriteBackCache<uint64_t, uint64_t, BackendReader, BackendWriter, CarCache> cache(1024, 64, flush_interval);
+        auto duration = measure_time<std::chrono::milliseconds>(
+                [&cache, &queries, &written] ()
+                {
+                    for (size_t i = 0; i < queries.size(); ++i)
+                    {
+                        if (i % 4 == 0)
+                        {
+                            cache.put(queries[i], i);
+                            written[queries[i]] = i;
+                        }
+                        else
+                        {
+                            auto latest = written.find(queries[i]);
+                            auto value = cache.get(queries[i]);
+                            assert(value == (latest != written.end() ? latest->second : queries[i]));
+                        }
+                    }
+                    cache.flush();
+                });
+        assert(BACKEND == written);
+
+        std::cout << cache.name() << " flush interval " << flush_interval.count() << "ms:  "
+                  << duration.count() << "ms puts: " << cache.get_puts()
+                  << " backend writes: " << cache.get_written_entries()
+                  << " in " << cache.get_writer_calls() << " batches"
+                  << "\n";
+    }
+
+    std::cout << "write-back test finished\n";
+}
+
+template <typename Key, template <typename, typename, typename...> class Policy>
+void run_string_key_queries(std::string const& key_name, size_t cache_size,
+                            std::vector<std::string_view> const& queries)
+{
+    Policy<Key, uint64_t, KeyLength> cache(cache_size);
+    auto heap_allocations_before = HEAP_ALLOCATIONS.load();
+    auto duration = measure_time<std::chrono::milliseconds>(
+            [&cache, &queries] ()
+            {
+                for (auto query : queries)
+                {
+                    assert(cache.get(Key(query)) == query.size());
+                }
+            });
+
+    std::cout << cache.name() << " " << key_name << " keys:  " << duration.count() << "ms"
+              << " misses: " << cache.get_cache_misses()
+              << " heap allocations: " << HEAP_ALLOCATIONS - heap_allocations_before
+              << "\n";
+}
+
+void string_key_test()
+{
+    std::cout << "string key test started\n";
+
+    auto current_settings = SETTINGS.at("random_tests");
+    const size_t CACHE_SIZE = current_settings.at("cache_size");
+
+    std::mt19937 g{42};
+    std::geometric_distribution<uint64_t> distribution(0.00001);
+    std::vector<std::string> keys(current_settings.at("test_size"));
+    for (auto & key : keys)
+    {
+        key = "user:session:" + std::to_string(distribution(g));
+    }
+    std::vector<std::string_view> queries(keys.begin(), keys.end());
+
+    run_string_key_queries<std::string, CarCache>("std::string", CACHE_SIZE, queries);
+    run_string_key_queries<StringKey, CarCache>("StringKey", CACHE_SIZE, queries);
+    run_string_key_queries<std::string, LruCache>("std::string", CACHE_SIZE, queries);
+    run_string_key_queries<StringKey, LruCache>("StringKey", CACHE_SIZE, queries);
+
+    std::cout << "string key test finished\n";
+}
+
 int main()
 {
     run_tests();
@@ -0,0 +1,234 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_MAPPED_LOG_H
+#define CACHINGPP_MAPPED_LOG_H
+
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+// Append-only log of fixed-size records in a memory-mapped file.
+// The file is split into segments; records are appended to the active segment
+// and a full log reclaims the segment with the fewest live records, dropping
+// whatever is still live in it. Not thread-safe, callers serialize access.
+template <typename Key, typename Value>
+class MappedLogStore
+{
+    static_assert(std::is_trivially_copyable<Key>::value, "MappedLogStore keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Value>::value, "MappedLogStore values must be trivially copyable");
+
+    struct Record
+    {
+        Key key;
+        Value value;
+    };
+
+    struct Segment
+    {
+        uint32_t used;
+        uint32_t live;
+    };
+
+public:
+    MappedLogStore(std::string const& path, size_t segments_count, size_t segment_records)
+            : fd_(-1),
+              records_(nullptr),
+              mapped_bytes_(segments_count * segment_records * sizeof(Record)),
+              segment_records_(segment_records),
+              segments_(segments_count, Segment{0, 0}),
+              active_segment_(0),
+              index_()
+    {
+        if (segments_count < 2 || segment_records == 0
+            || segments_count * segment_records > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::invalid_argument("MappedLogStore: bad segment geometry");
+        }
+
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd_ < 0)
+        {
+            throw std::runtime_error("MappedLogStore: cannot open " + path);
+        }
+        // the index lives in memory only, so the file is useless after we are gone
+        ::unlink(path.c_str());
+
+        if (::ftruncate(fd_, mapped_bytes_) != 0)
+        {
+            ::close(fd_);
+            throw std::runtime_error("MappedLogStore: cannot resize " + path);
+        }
+
+        void* addr = ::mmap(nullptr, mapped_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED)
+        {
+            ::close(fd_);
+            throw std::runtime_error("MappedLogStore: cannot map " + path);
+        }
+        records_ = static_cast<Record*>(addr);
+        index_.reserve(segments_count * segment_records);
+    }
+
+    MappedLogStore(MappedLogStore const&) = delete;
+    MappedLogStore& operator=(MappedLogStore const&) = delete;
+
+    ~MappedLogStore()
+    {
+        ::munmap(records_, mapped_bytes_);
+        ::close(fd_);
+    }
+
+    bool find(Key const& key, Value& value) const
+    {
+        auto it = index_.find(key);
+        if (it == index_.end())
+        {
+            return false;
+        }
+        std::memcpy(&value, &records_[it->second].value, sizeof(Value));
+        return true;
+    }
+
+    template <typename Iterator>
+    void append(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            append_one(first->first, first->second);
+        }
+    }
+
+    bool erase(Key const& key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end())
+        {
+            return false;
+        }
+        --segments_[it->second / segment_records_].live;
+        index_.erase(it);
+        return true;
+    }
+
+    template <typename Predicate>
+    size_t erase_if(Predicate predicate)
+    {
+        size_t erased = 0;
+        for (auto it = index_.begin(); it != index_.end();)
+        {
+            Record record;
+            std::memcpy(&record, &records_[it->second], sizeof(Record));
+            if (predicate(record.key, record.value))
+            {
+                --segments_[it->second / segment_records_].live;
+                it = index_.erase(it);
+                ++erased;
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return erased;
+    }
+
+    size_t size() const
+    {
+        return index_.size();
+    }
+
+    uint64_t get_reclaimed_segments() const
+    {
+        return reclaimed_segments_;
+    }
+
+private:
+    int fd_;
+    Record* records_;
+    size_t mapped_bytes_;
+    size_t segment_records_;
+    std::vector<Segment> segments_;
+    size_t active_segment_;
+    uint64_t reclaimed_segments_ = 0;
+
+    std::unordered_map<Key, uint32_t> index_;
+
+    void append_one(Key const& key, Value const& value)
+    {
+        if (segments_[active_segment_].used == segment_records_)
+        {
+            open_next_segment();
+        }
+
+        auto & active = segments_[active_segment_];
+        uint32_t slot = active_segment_ * segment_records_ + active.used;
+        std::memcpy(&records_[slot].key, &key, sizeof(Key));
+        std::memcpy(&records_[slot].value, &value, sizeof(Value));
+        ++active.used;
+        ++active.live;
+
+        auto it = index_.find(key);
+        if (it != index_.end())
+        {
+            --segments_[it->second / segment_records_].live;
+            it->second = slot;
+        }
+        else
+        {
+            index_.insert({key, slot});
+        }
+    }
+
+    void open_next_segment()
+    {
+        size_t victim = active_segment_;
+        for (size_t i = 1; i < segments_.size(); ++i)
+        {
+            size_t candidate = (active_segment_ + i) % segments_.size();
+            if (victim == active_segment_ || segments_[candidate].live < segments_[victim].live)
+            {
+                victim = candidate;
+            }
+            if (segments_[candidate].used == 0)
+            {
+                break;
+            }
+        }
+
+        if (segments_[victim].used != 0)
+        {
+            reclaim_segment(victim);
+        }
+        active_segment_ = victim;
+    }
+
+    void reclaim_segment(size_t segment)
+    {
+        uint32_t first_slot = segment * segment_records_;
+        for (uint32_t slot = first_slot; slot < first_slot + segments_[segment].used; ++slot)
+        {
+            auto it = index_.find(records_[slot].key);
+            if (it != index_.end() && it->second == slot)
+            {
+                index_.erase(it);
+            }
+        }
+        segments_[segment] = Segment{0, 0};
+        ++reclaimed_segments_;
+    }
+};
+
+
+#endif //CACHINGPP_MAPPED_LOG_H
@@ -0,0 +1,87 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_MEMCACHED_PROTOCOL_H
+#define CACHINGPP_MEMCACHED_PROTOCOL_H
+
+
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+
+// Pieces of the memcached text and meta protocols shared by the server and the load generator.
+
+static const size_t MEMCACHED_MAX_KEY_LENGTH = 250;
+
+
+// length of the first line including its "\n", or 0 while the line is incomplete
+inline size_t find_line(std::string_view buffer)
+{
+    auto end = static_cast<char const*>(std::memchr(buffer.data(), '\n', buffer.size()));
+    return end ? end - buffer.data() + 1 : 0;
+}
+
+// the line without its "\r\n" or "\n"
+inline std::string_view strip_line(std::string_view line)
+{
+    line.remove_suffix(1);
+    if (!line.empty() && line.back() == '\r')
+    {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+
+// Walks the space separated tokens of a command line without copying them.
+class TokenCursor
+{
+public:
+    explicit
+    TokenCursor(std::string_view line)
+            : rest_(line)
+    {}
+
+    bool next(std::string_view& token)
+    {
+        size_t begin = rest_.find_first_not_of(' ');
+        if (begin == std::string_view::npos)
+        {
+            rest_ = std::string_view();
+            return false;
+        }
+        size_t end = rest_.find(' ', begin);
+        if (end == std::string_view::npos)
+        {
+            end = rest_.size();
+        }
+        token = rest_.substr(begin, end - begin);
+        rest_.remove_prefix(end);
+        return true;
+    }
+
+private:
+    std::string_view rest_;
+};
+
+
+// the whole token has to be a number
+template <typename Number>
+bool parse_number(std::string_view token, Number& number)
+{
+    auto result = std::from_chars(token.data(), token.data() + token.size(), number);
+    return result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+inline void append_number(std::string& out, uint64_t number)
+{
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), number);
+    out.append(digits, result.ptr - digits);
+}
+
+
+#endif //CACHINGPP_MEMCACHED_PROTOCOL_H
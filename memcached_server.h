@@ -0,0 +1,1040 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_MEMCACHED_SERVER_H
+#define CACHINGPP_MEMCACHED_SERVER_H
+
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "string_key.h"
+#include "memcached_protocol.h"
+
+
+struct MemcachedItem
+{
+    uint32_t flags;
+    uint64_t cas;
+    std::string data;
+};
+
+using MemcachedItemPtr = std::shared_ptr<MemcachedItem const>;
+
+// loader of a plain cache server: whatever the cache does not hold is absent.
+// The server looks items up with find(), so a miss is never loaded or cached.
+struct AbsentItems
+{
+    MemcachedItemPtr operator() (StringKey const&) const
+    {
+        return nullptr;
+    }
+};
+
+
+// Serves a BaseCache over TCP and Unix sockets with the memcached text protocol
+// (get, gets, set, delete, flush_all, version, quit) and the meta commands mg, ms, md, mn.
+// Every reactor thread has its own epoll set; the listening sockets are shared through
+// EPOLLEXCLUSIVE and a connection stays on the reactor that accepted it. Pipelined
+// requests are answered with one write, and connection buffers are reused.
+// Lookups do not admit missing keys. Expiration times are accepted and ignored.
+template <typename EntryAlloc>
+class MemcachedServer
+{
+    enum class Kind
+    {
+        TCP_LISTENER,
+        UNIX_LISTENER,
+        WAKER,
+        CONNECTION
+    };
+
+    struct Pollable
+    {
+        Kind kind;
+        int fd;
+    };
+
+    struct Connection : Pollable
+    {
+        size_t slot;
+        std::vector<char> read_buffer;
+        size_t read_begin;
+        size_t read_end;
+        size_t swallow;         // bytes of a rejected value still to be discarded
+        std::string write_buffer;
+        size_t written;
+        uint32_t events;
+        bool closing;
+    };
+
+    struct Reactor
+    {
+        int epoll_fd = -1;
+        Pollable waker {Kind::WAKER, -1};
+        std::thread thread;
+        std::vector<std::unique_ptr<Connection>> connections;
+        std::vector<std::unique_ptr<Connection>> spare_connections;
+        std::vector<Connection*> closed_connections;
+
+        std::atomic<uint64_t> accepted {0};
+        std::atomic<uint64_t> requests {0};
+        std::atomic<uint64_t> hits {0};
+        std::atomic<uint64_t> misses {0};
+    };
+
+    // what the meta commands were asked to return
+    struct MetaFlags
+    {
+        bool value = false;
+        bool quiet = false;
+        bool client_flags = false;
+        bool cas = false;
+        bool size = false;
+        bool key = false;
+        bool ttl = false;
+        uint32_t set_flags = 0;
+        std::string_view opaque;
+    };
+
+public:
+    using Cache = BaseCache<StringKey, MemcachedItemPtr, EntryAlloc>;
+
+    static const size_t READ_BUFFER_BYTES = 16 * 1024;
+    static const size_t MAX_LINE_BYTES = 64 * 1024;
+    static const size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+    static const size_t MAX_SPARE_CONNECTIONS = 64;
+    static const int EVENTS_BATCH = 256;
+
+    explicit
+    MemcachedServer(Cache& cache, size_t reactors_count = 4, size_t max_item_size = 1024 * 1024)
+            : cache_(cache),
+              max_item_size_(max_item_size),
+              max_request_bytes_(max_item_size + MAX_LINE_BYTES + 2),
+              tcp_port_(0),
+              next_cas_(0),
+              started_(false),
+              stopped_(false)
+    {
+        try
+        {
+            for (size_t i = 0; i < reactors_count; ++i)
+            {
+                reactors_.emplace_back(new Reactor());
+                auto & reactor = *reactors_.back();
+                reactor.epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+                reactor.waker.fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+                if (reactor.epoll_fd < 0 || reactor.waker.fd < 0)
+                {
+                    throw_error("cannot create a reactor");
+                }
+                watch(reactor, reactor.waker, EPOLLIN);
+            }
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    MemcachedServer(MemcachedServer const&) = delete;
+    MemcachedServer& operator=(MemcachedServer const&) = delete;
+
+    ~MemcachedServer()
+    {
+        stop();
+        release();
+    }
+
+    // port 0 picks a free port, see get_tcp_port()
+    void listen_tcp(std::string const& host, uint16_t port)
+    {
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        if (::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+        {
+            throw std::invalid_argument("MemcachedServer: bad IPv4 address " + host);
+        }
+
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd < 0 || ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+            || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(fd, SOMAXCONN) != 0)
+        {
+            close_and_throw(fd, "cannot listen on " + host + ":" + std::to_string(port));
+        }
+
+        socklen_t length = sizeof(address);
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length);
+        tcp_port_ = ntohs(address.sin_port);
+        add_listener(Kind::TCP_LISTENER, fd);
+    }
+
+    void listen_unix(std::string const& path)
+    {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            throw std::invalid_argument("MemcachedServer: socket path too long " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        ::unlink(path.c_str());
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(fd, SOMAXCONN) != 0)
+        {
+            close_and_throw(fd, "cannot listen on " + path);
+        }
+        unix_paths_.push_back(path);
+        add_listener(Kind::UNIX_LISTENER, fd);
+    }
+
+    uint16_t get_tcp_port() const
+    {
+        return tcp_port_;
+    }
+
+    void start()
+    {
+        if (started_.exchange(true))
+        {
+            return;
+        }
+        for (auto & reactor : reactors_)
+        {
+            Reactor* serving = reactor.get();
+            reactor->thread = std::thread([this, serving] ()
+                                          {
+                                              run_reactor(*serving);
+                                          });
+        }
+    }
+
+    void stop()
+    {
+        if (stopped_.exchange(true))
+        {
+            return;
+        }
+        for (auto & reactor : reactors_)
+        {
+            uint64_t one = 1;
+            ssize_t written = ::write(reactor->waker.fd, &one, sizeof(one));
+            (void) written;
+        }
+        for (auto & reactor : reactors_)
+        {
+            if (reactor->thread.joinable())
+            {
+                reactor->thread.join();
+            }
+        }
+    }
+
+    uint64_t get_connections() const
+    {
+        return sum(&Reactor::accepted);
+    }
+
+    uint64_t get_requests() const
+    {
+        return sum(&Reactor::requests);
+    }
+
+    uint64_t get_hits() const
+    {
+        return sum(&Reactor::hits);
+    }
+
+    uint64_t get_misses() const
+    {
+        return sum(&Reactor::misses);
+    }
+
+private:
+    Cache& cache_;
+    size_t max_item_size_;
+    size_t max_request_bytes_;
+    uint16_t tcp_port_;
+    std::atomic<uint64_t> next_cas_;
+    std::atomic<bool> started_;
+    std::atomic<bool> stopped_;
+
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::vector<std::unique_ptr<Pollable>> listeners_;
+    std::vector<std::string> unix_paths_;
+
+    static void throw_error(std::string const& what)
+    {
+        throw std::runtime_error("MemcachedServer: " + what + ": " + std::strerror(errno));
+    }
+
+    static void close_and_throw(int fd, std::string const& what)
+    {
+        int error = errno;
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        errno = error;
+        throw_error(what);
+    }
+
+    uint64_t sum(std::atomic<uint64_t> Reactor::* counter) const
+    {
+        uint64_t total = 0;
+        for (auto const& reactor : reactors_)
+        {
+            total += ((*reactor).*counter).load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void release()
+    {
+        for (auto & reactor : reactors_)
+        {
+            for (auto & connection : reactor->connections)
+            {
+                ::close(connection->fd);
+            }
+            reactor->connections.clear();
+            if (reactor->waker.fd >= 0)
+            {
+                ::close(reactor->waker.fd);
+            }
+            if (reactor->epoll_fd >= 0)
+            {
+                ::close(reactor->epoll_fd);
+            }
+        }
+        reactors_.clear();
+        for (auto & listener : listeners_)
+        {
+            ::close(listener->fd);
+        }
+        listeners_.clear();
+        for (auto const& path : unix_paths_)
+        {
+            ::unlink(path.c_str());
+        }
+        unix_paths_.clear();
+    }
+
+    static void watch(Reactor& reactor, Pollable& pollable, uint32_t events)
+    {
+        epoll_event event {};
+        event.events = events;
+        event.data.ptr = &pollable;
+        if (::epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, pollable.fd, &event) != 0)
+        {
+            throw_error("cannot watch a socket");
+        }
+    }
+
+    void add_listener(Kind kind, int fd)
+    {
+        listeners_.emplace_back(new Pollable {kind, fd});
+        for (auto & reactor : reactors_)
+        {
+            watch(*reactor, *listeners_.back(), EPOLLIN | EPOLLEXCLUSIVE);
+        }
+    }
+
+    void run_reactor(Reactor& reactor)
+    {
+        epoll_event events[EVENTS_BATCH];
+        while (!stopped_.load(std::memory_order_acquire))
+        {
+            int ready = ::epoll_wait(reactor.epoll_fd, events, EVENTS_BATCH, -1);
+            if (ready < 0 && errno != EINTR)
+            {
+                return;
+            }
+            for (int i = 0; i < ready; ++i)
+            {
+                auto pollable = static_cast<Pollable*>(events[i].data.ptr);
+                switch (pollable->kind)
+                {
+                case Kind::TCP_LISTENER:
+                case Kind::UNIX_LISTENER:
+                    accept_connection(reactor, *pollable);
+                    break;
+                case Kind::CONNECTION:
+                    serve(reactor, static_cast<Connection&>(*pollable), events[i].events);
+                    break;
+                case Kind::WAKER:
+                    break;
+                }
+            }
+            recycle_closed(reactor);
+        }
+    }
+
+    // one connection per wakeup, so a burst of clients spreads over the idle reactors
+    void accept_connection(Reactor& reactor, Pollable& listener)
+    {
+        int fd = ::accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        if (listener.kind == Kind::TCP_LISTENER)
+        {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        std::unique_ptr<Connection> connection;
+        if (!reactor.spare_connections.empty())
+        {
+            connection = std::move(reactor.spare_connections.back());
+            reactor.spare_connections.pop_back();
+        }
+        else
+        {
+            connection.reset(new Connection());
+            connection->kind = Kind::CONNECTION;
+            connection->read_buffer.resize(READ_BUFFER_BYTES);
+        }
+        connection->fd = fd;
+        connection->slot = reactor.connections.size();
+        connection->read_begin = 0;
+        connection->read_end = 0;
+        connection->swallow = 0;
+        connection->write_buffer.clear();
+        connection->written = 0;
+        connection->events = EPOLLIN;
+        connection->closing = false;
+
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.ptr = connection.get();
+        if (::epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            ::close(fd);
+            return;
+        }
+        reactor.connections.push_back(std::move(connection));
+        reactor.accepted.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void close_connection(Reactor& reactor, Connection& connection)
+    {
+        ::epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+        ::close(connection.fd);
+        connection.fd = -1;
+        reactor.closed_connections.push_back(&connection);
+    }
+
+    // closed connections keep their buffers for the next accepted ones
+    void recycle_closed(Reactor& reactor)
+    {
+        for (auto closed : reactor.closed_connections)
+        {
+            auto & connections = reactor.connections;
+            size_t slot = closed->slot;
+            std::unique_ptr<Connection> connection = std::move(connections[slot]);
+            if (slot + 1 != connections.size())
+            {
+                connections[slot] = std::move(connections.back());
+                connections[slot]->slot = slot;
+            }
+            connections.pop_back();
+            if (reactor.spare_connections.size() < MAX_SPARE_CONNECTIONS)
+            {
+                reactor.spare_connections.push_back(std::move(connection));
+            }
+        }
+        reactor.closed_connections.clear();
+    }
+
+    void serve(Reactor& reactor, Connection& connection, uint32_t events)
+    {
+        if (connection.fd < 0)
+        {
+            return;
+        }
+        if ((events & EPOLLOUT) && !flush(connection))
+        {
+            close_connection(reactor, connection);
+            return;
+        }
+        if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !receive(connection))
+        {
+            close_connection(reactor, connection);
+            return;
+        }
+
+        // requests left behind by a full write buffer are picked up once it drains
+        bool output_full = true;
+        while (output_full && connection.written == connection.write_buffer.size())
+        {
+            output_full = process(reactor, connection);
+            if (!flush(connection))
+            {
+                close_connection(reactor, connection);
+                return;
+            }
+        }
+
+        bool pending_output = connection.written < connection.write_buffer.size();
+        if (connection.closing && !pending_output)
+        {
+            close_connection(reactor, connection);
+            return;
+        }
+        uint32_t wanted = pending_output ? EPOLLOUT : EPOLLIN;
+        if (wanted != connection.events)
+        {
+            epoll_event event {};
+            event.events = wanted;
+            event.data.ptr = &connection;
+            ::epoll_ctl(reactor.epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.events = wanted;
+        }
+    }
+
+    // false once the peer is gone
+    bool receive(Connection& connection)
+    {
+        auto & buffer = connection.read_buffer;
+        while (true)
+        {
+            if (connection.read_end == buffer.size())
+            {
+                if (connection.read_begin != 0)
+                {
+                    std::memmove(buffer.data(), buffer.data() + connection.read_begin,
+                                 connection.read_end - connection.read_begin);
+                    connection.read_end -= connection.read_begin;
+                    connection.read_begin = 0;
+                }
+                else if (buffer.size() < max_request_bytes_)
+                {
+                    buffer.resize(std::min(buffer.size() * 2, max_request_bytes_));
+                }
+                else
+                {
+                    return true;
+                }
+            }
+
+            size_t space = buffer.size() - connection.read_end;
+            ssize_t received = ::recv(connection.fd, buffer.data() + connection.read_end, space, 0);
+            if (received > 0)
+            {
+                connection.read_end += received;
+                if (static_cast<size_t>(received) < space)
+                {
+                    return true;
+                }
+            }
+            else if (received == 0)
+            {
+                return false;
+            }
+            else if (errno != EINTR)
+            {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+        }
+    }
+
+    // false once the peer is gone
+    bool flush(Connection& connection)
+    {
+        auto & buffer = connection.write_buffer;
+        while (connection.written < buffer.size())
+        {
+            ssize_t sent = ::send(connection.fd, buffer.data() + connection.written,
+                                  buffer.size() - connection.written, MSG_NOSIGNAL);
+            if (sent > 0)
+            {
+                connection.written += sent;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                return true;
+            }
+            else if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+        buffer.clear();
+        connection.written = 0;
+        return true;
+    }
+
+    // answers every complete request in the read buffer, true if it stopped on a full write buffer
+    bool process(Reactor& reactor, Connection& connection)
+    {
+        while (!connection.closing)
+        {
+            if (connection.write_buffer.size() - connection.written >= MAX_PENDING_OUTPUT)
+            {
+                return true;
+            }
+
+            size_t available = connection.read_end - connection.read_begin;
+            if (connection.swallow != 0)
+            {
+                size_t discarded = std::min(connection.swallow, available);
+                connection.read_begin += discarded;
+                connection.swallow -= discarded;
+                available -= discarded;
+            }
+
+            size_t consumed = 0;
+            if (available != 0 && connection.swallow == 0)
+            {
+                std::string_view input(connection.read_buffer.data() + connection.read_begin, available);
+                consumed = handle_request(reactor, connection, input);
+            }
+            if (consumed == 0)
+            {
+                // a request that does not fit in the buffer never completes, and EPOLLIN would keep firing
+                if (available == max_request_bytes_)
+                {
+                    connection.write_buffer += "CLIENT_ERROR request too large\r\n";
+                    connection.closing = true;
+                }
+                break;
+            }
+            connection.read_begin += consumed;
+        }
+
+        if (connection.read_begin == connection.read_end)
+        {
+            connection.read_begin = 0;
+            connection.read_end = 0;
+        }
+        return false;
+    }
+
+    // bytes taken by the first request of input, 0 while it is incomplete
+    size_t handle_request(Reactor& reactor, Connection& connection, std::string_view input)
+    {
+        auto & out = connection.write_buffer;
+        // with lines kept to MAX_LINE_BYTES every request fits in max_request_bytes_
+        size_t line_length = find_line(input);
+        if (line_length > MAX_LINE_BYTES || (line_length == 0 && input.size() > MAX_LINE_BYTES))
+        {
+            out += "CLIENT_ERROR line too long\r\n";
+            connection.closing = true;
+            return input.size();
+        }
+        if (line_length == 0)
+        {
+            return 0;
+        }
+
+        TokenCursor tokens(strip_line(input.substr(0, line_length)));
+        std::string_view command;
+        if (!tokens.next(command))
+        {
+            out += "ERROR\r\n";
+            return line_length;
+        }
+        reactor.requests.fetch_add(1, std::memory_order_relaxed);
+
+        if (command == "get" || command == "gets")
+        {
+            handle_get(reactor, out, tokens, command.size() == 4);
+        }
+        else if (command == "mg")
+        {
+            handle_meta_get(reactor, out, tokens);
+        }
+        else if (command == "set")
+        {
+            return handle_set(connection, tokens, input, line_length);
+        }
+        else if (command == "ms")
+        {
+            return handle_meta_set(connection, tokens, input, line_length);
+        }
+        else if (command == "delete")
+        {
+            handle_delete(out, tokens);
+        }
+        else if (command == "md")
+        {
+            handle_meta_delete(out, tokens);
+        }
+        else if (command == "mn")
+        {
+            out += "MN\r\n";
+        }
+        else if (command == "flush_all")
+        {
+            cache_.invalidate_if([] (StringKey const&, MemcachedItemPtr const&)
+                                 {
+                                     return true;
+                                 });
+            if (!has_noreply(tokens))
+            {
+                out += "OK\r\n";
+            }
+        }
+        else if (command == "version")
+        {
+            out += "VERSION cachingpp-1.0\r\n";
+        }
+        else if (command == "quit")
+        {
+            connection.closing = true;
+        }
+        else
+        {
+            out += "ERROR\r\n";
+        }
+        return line_length;
+    }
+
+    void handle_get(Reactor& reactor, std::string& out, TokenCursor& tokens, bool with_cas)
+    {
+        std::string_view key;
+        bool any_key = false;
+        while (tokens.next(key))
+        {
+            if (key.size() > MEMCACHED_MAX_KEY_LENGTH)
+            {
+                out += "CLIENT_ERROR bad command line format\r\n";
+                return;
+            }
+            any_key = true;
+
+            MemcachedItemPtr item;
+            if (!cache_.find(StringKey(key), item) || !item)
+            {
+                reactor.misses.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            reactor.hits.fetch_add(1, std::memory_order_relaxed);
+
+            out += "VALUE ";
+            out += key;
+            out += ' ';
+            append_number(out, item->flags);
+            out += ' ';
+            append_number(out, item->data.size());
+            if (with_cas)
+            {
+                out += ' ';
+                append_number(out, item->cas);
+            }
+            out += "\r\n";
+            out += item->data;
+            out += "\r\n";
+        }
+        out += any_key ? "END\r\n" : "ERROR\r\n";
+    }
+
+    void handle_meta_get(Reactor& reactor, std::string& out, TokenCursor& tokens)
+    {
+        std::string_view key;
+        MetaFlags flags;
+        if (!tokens.next(key) || key.size() > MEMCACHED_MAX_KEY_LENGTH)
+        {
+            out += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+        if (!parse_meta_flags(tokens, "vqfcsktO", flags))
+        {
+            out += "CLIENT_ERROR invalid flag\r\n";
+            return;
+        }
+
+        MemcachedItemPtr item;
+        if (!cache_.find(StringKey(key), item) || !item)
+        {
+            reactor.misses.fetch_add(1, std::memory_order_relaxed);
+            if (!flags.quiet)
+            {
+                out += "EN\r\n";
+            }
+            return;
+        }
+        reactor.hits.fetch_add(1, std::memory_order_relaxed);
+
+        if (flags.value)
+        {
+            out += "VA ";
+            append_number(out, item->data.size());
+        }
+        else
+        {
+            out += "HD";
+        }
+        append_meta_flags(out, flags, key, item.get());
+        out += "\r\n";
+        if (flags.value)
+        {
+            out += item->data;
+            out += "\r\n";
+        }
+    }
+
+    size_t handle_set(Connection& connection, TokenCursor& tokens, std::string_view input, size_t line_length)
+    {
+        auto & out = connection.write_buffer;
+        std::string_view key;
+        std::string_view client_flags;
+        std::string_view exptime;
+        std::string_view bytes;
+        uint32_t flags = 0;
+        int64_t expiration = 0;
+        size_t size = 0;
+        if (!tokens.next(key) || !tokens.next(client_flags) || !tokens.next(exptime) || !tokens.next(bytes)
+            || key.size() > MEMCACHED_MAX_KEY_LENGTH || !parse_number(client_flags, flags)
+            || !parse_number(exptime, expiration) || !parse_number(bytes, size))
+        {
+            out += "CLIENT_ERROR bad command line format\r\n";
+            return line_length;
+        }
+        bool noreply = has_noreply(tokens);
+
+        if (size > max_item_size_)
+        {
+            out += "SERVER_ERROR object too large for cache\r\n";
+            connection.swallow = size + 2;
+            return line_length;
+        }
+        if (input.size() < line_length + size + 2)
+        {
+            return 0;
+        }
+        if (input.substr(line_length + size, 2) != "\r\n")
+        {
+            out += "CLIENT_ERROR bad data chunk\r\n";
+            return line_length + size + 2;
+        }
+
+        store(key, flags, input.substr(line_length, size));
+        if (!noreply)
+        {
+            out += "STORED\r\n";
+        }
+        return line_length + size + 2;
+    }
+
+    size_t handle_meta_set(Connection& connection, TokenCursor& tokens, std::string_view input, size_t line_length)
+    {
+        auto & out = connection.write_buffer;
+        std::string_view key;
+        std::string_view bytes;
+        size_t size = 0;
+        MetaFlags flags;
+        if (!tokens.next(key) || !tokens.next(bytes)
+            || key.size() > MEMCACHED_MAX_KEY_LENGTH || !parse_number(bytes, size))
+        {
+            out += "CLIENT_ERROR bad command line format\r\n";
+            return line_length;
+        }
+        if (size > max_item_size_)
+        {
+            out += "SERVER_ERROR object too large for cache\r\n";
+            connection.swallow = size + 2;
+            return line_length;
+        }
+        if (!parse_meta_flags(tokens, "qOkcFTM", flags))
+        {
+            out += "CLIENT_ERROR invalid flag\r\n";
+            connection.swallow = size + 2;
+            return line_length;
+        }
+        if (input.size() < line_length + size + 2)
+        {
+            return 0;
+        }
+        if (input.substr(line_length + size, 2) != "\r\n")
+        {
+            out += "CLIENT_ERROR bad data chunk\r\n";
+            return line_length + size + 2;
+        }
+
+        MemcachedItemPtr item = store(key, flags.set_flags, input.substr(line_length, size));
+        if (!flags.quiet)
+        {
+            out += "HD";
+            append_meta_flags(out, flags, key, item.get());
+            out += "\r\n";
+        }
+        return line_length + size + 2;
+    }
+
+    void handle_delete(std::string& out, TokenCursor& tokens)
+    {
+        std::string_view key;
+        if (!tokens.next(key) || key.size() > MEMCACHED_MAX_KEY_LENGTH)
+        {
+            out += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+        bool erased = cache_.erase(StringKey(key));
+        if (!has_noreply(tokens))
+        {
+            out += erased ? "DELETED\r\n" : "NOT_FOUND\r\n";
+        }
+    }
+
+    void handle_meta_delete(std::string& out, TokenCursor& tokens)
+    {
+        std::string_view key;
+        MetaFlags flags;
+        if (!tokens.next(key) || key.size() > MEMCACHED_MAX_KEY_LENGTH)
+        {
+            out += "CLIENT_ERROR bad command line format\r\n";
+            return;
+        }
+        if (!parse_meta_flags(tokens, "qOk", flags))
+        {
+            out += "CLIENT_ERROR invalid flag\r\n";
+            return;
+        }
+        bool erased = cache_.erase(StringKey(key));
+        if (!flags.quiet)
+        {
+            out += erased ? "HD" : "NF";
+            append_meta_flags(out, flags, key, nullptr);
+            out += "\r\n";
+        }
+    }
+
+    MemcachedItemPtr store(std::string_view key, uint32_t flags, std::string_view data)
+    {
+        auto cas = next_cas_.fetch_add(1, std::memory_order_relaxed) + 1;
+        MemcachedItemPtr item = std::make_shared<MemcachedItem>(MemcachedItem {flags, cas, std::string(data)});
+        cache_.put(StringKey(key), item);
+        return item;
+    }
+
+    // legacy "delete <key> 0" and "flush_all <delay>" arguments are skipped
+    static bool has_noreply(TokenCursor& tokens)
+    {
+        std::string_view token;
+        while (tokens.next(token))
+        {
+            if (token == "noreply")
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parse_meta_flags(TokenCursor& tokens, std::string_view allowed, MetaFlags& flags)
+    {
+        std::string_view flag;
+        while (tokens.next(flag))
+        {
+            if (allowed.find(flag[0]) == std::string_view::npos)
+            {
+                return false;
+            }
+            switch (flag[0])
+            {
+            case 'v':
+                flags.value = true;
+                break;
+            case 'q':
+                flags.quiet = true;
+                break;
+            case 'f':
+                flags.client_flags = true;
+                break;
+            case 'c':
+                flags.cas = true;
+                break;
+            case 's':
+                flags.size = true;
+                break;
+            case 'k':
+                flags.key = true;
+                break;
+            case 't':
+                flags.ttl = true;
+                break;
+            case 'O':
+                flags.opaque = flag.substr(1);
+                break;
+            case 'F':
+                if (!parse_number(flag.substr(1), flags.set_flags))
+                {
+                    return false;
+                }
+                break;
+            case 'M':
+                if (flag.size() != 2 || (flag[1] != 'S' && flag[1] != 's'))
+                {
+                    return false;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    static void append_meta_flags(std::string& out, MetaFlags const& flags, std::string_view key,
+                                  MemcachedItem const* item)
+    {
+        if (item && flags.client_flags)
+        {
+            out += " f";
+            append_number(out, item->flags);
+        }
+        if (item && flags.cas)
+        {
+            out += " c";
+            append_number(out, item->cas);
+        }
+        if (item && flags.size)
+        {
+            out += " s";
+            append_number(out, item->data.size());
+        }
+        if (item && flags.ttl)
+        {
+            out += " t-1";
+        }
+        if (flags.key)
+        {
+            out += " k";
+            out += key;
+        }
+        if (!flags.opaque.empty())
+        {
+            out += " O";
+            out += flags.opaque;
+        }
+    }
+};
+
+
+#endif //CACHINGPP_MEMCACHED_SERVER_H
@@ -0,0 +1,255 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_NODE_POOL_H
+#define CACHINGPP_NODE_POOL_H
+
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstdint>
+
+#include <sys/mman.h>
+
+
+enum class HugePages
+{
+    NONE,
+    TRANSPARENT,    // madvise(MADV_HUGEPAGE) on regular mappings
+    EXPLICIT        // MAP_HUGETLB, falls back to TRANSPARENT when no huge pages are reserved
+};
+
+
+// Bump allocator over large anonymous mappings with a free list per node size.
+// Only small single-object allocations are served from the arena, everything
+// else goes to operator new. Not thread-safe, the owning cache serializes access.
+class NodeArena
+{
+    struct FreeNode
+    {
+        FreeNode* next;
+    };
+
+public:
+    static const size_t GRANULARITY = sizeof(void*);
+    static const size_t MAX_NODE_SIZE = 256;
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    NodeArena(size_t reserve_bytes, HugePages huge_pages)
+            : huge_pages_(huge_pages),
+              region_bytes_(reserve_bytes > HUGE_PAGE_SIZE ? reserve_bytes : HUGE_PAGE_SIZE),
+              regions_(),
+              bump_(nullptr),
+              bump_end_(nullptr),
+              free_lists_(),
+              allocations_(0),
+              reused_nodes_(0),
+              mapped_bytes_(0)
+    {
+        region_bytes_ = (region_bytes_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        map_region();
+    }
+
+    NodeArena(NodeArena const&) = delete;
+    NodeArena& operator=(NodeArena const&) = delete;
+
+    ~NodeArena()
+    {
+        for (auto const& region : regions_)
+        {
+            ::munmap(region.first, region.second);
+        }
+    }
+
+    static bool serves(size_t bytes, size_t alignment)
+    {
+        return bytes <= MAX_NODE_SIZE && alignment <= GRANULARITY;
+    }
+
+    void* allocate(size_t bytes)
+    {
+        ++allocations_;
+        size_t size_class = (bytes + GRANULARITY - 1) / GRANULARITY;
+        FreeNode*& free_list = free_lists_[size_class];
+        if (free_list)
+        {
+            ++reused_nodes_;
+            FreeNode* node = free_list;
+            free_list = node->next;
+            return node;
+        }
+
+        size_t node_bytes = size_class * GRANULARITY;
+        if (bump_ + node_bytes > bump_end_)
+        {
+            map_region();
+        }
+        void* node = bump_;
+        bump_ += node_bytes;
+        return node;
+    }
+
+    void deallocate(void* node, size_t bytes)
+    {
+        size_t size_class = (bytes + GRANULARITY - 1) / GRANULARITY;
+        auto freed = static_cast<FreeNode*>(node);
+        freed->next = free_lists_[size_class];
+        free_lists_[size_class] = freed;
+    }
+
+    uint64_t get_allocations() const
+    {
+        return allocations_;
+    }
+
+    uint64_t get_reused_nodes() const
+    {
+        return reused_nodes_;
+    }
+
+    size_t get_mapped_bytes() const
+    {
+        return mapped_bytes_;
+    }
+
+private:
+    HugePages huge_pages_;
+    size_t region_bytes_;
+    std::vector<std::pair<void*, size_t>> regions_;
+    char* bump_;
+    char* bump_end_;
+    FreeNode* free_lists_[MAX_NODE_SIZE / GRANULARITY + 1];
+
+    uint64_t allocations_;
+    uint64_t reused_nodes_;
+    size_t mapped_bytes_;
+
+    void map_region()
+    {
+        void* addr = MAP_FAILED;
+        if (huge_pages_ == HugePages::EXPLICIT)
+        {
+            addr = ::mmap(nullptr, region_bytes_, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        if (addr == MAP_FAILED)
+        {
+            addr = ::mmap(nullptr, region_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (addr == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+            if (huge_pages_ != HugePages::NONE)
+            {
+                ::madvise(addr, region_bytes_, MADV_HUGEPAGE);
+            }
+        }
+
+        regions_.emplace_back(addr, region_bytes_);
+        mapped_bytes_ += region_bytes_;
+        bump_ = static_cast<char*>(addr);
+        bump_end_ = bump_ + region_bytes_;
+    }
+};
+
+
+template <typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    explicit
+    PoolAllocator(NodeArena* arena)
+            : arena_(arena)
+    {}
+
+    template <typename U>
+    PoolAllocator(PoolAllocator<U> const& other)
+            : arena_(other.arena())
+    {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1 && NodeArena::serves(sizeof(T), alignof(T)))
+        {
+            return static_cast<T*>(arena_->allocate(sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n == 1 && NodeArena::serves(sizeof(T), alignof(T)))
+        {
+            arena_->deallocate(p, sizeof(T));
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    NodeArena* arena() const
+    {
+        return arena_;
+    }
+
+private:
+    NodeArena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(PoolAllocator<T> const& lhs, PoolAllocator<U> const& rhs)
+{
+    return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(PoolAllocator<T> const& lhs, PoolAllocator<U> const& rhs)
+{
+    return !(lhs == rhs);
+}
+
+
+// Node storage policies for the caches: where list and map nodes come from.
+
+struct HeapNodes
+{
+    template <typename T>
+    using Allocator = std::allocator<T>;
+
+    explicit
+    HeapNodes(size_t /* reserve_bytes */)
+    {}
+
+    template <typename T>
+    Allocator<T> allocator()
+    {
+        return Allocator<T>();
+    }
+};
+
+
+template <HugePages Mode = HugePages::TRANSPARENT>
+struct PooledNodes
+{
+    template <typename T>
+    using Allocator = PoolAllocator<T>;
+
+    explicit
+    PooledNodes(size_t reserve_bytes)
+            : arena(reserve_bytes, Mode)
+    {}
+
+    template <typename T>
+    Allocator<T> allocator()
+    {
+        return Allocator<T>(&arena);
+    }
+
+    NodeArena arena;
+};
+
+
+#endif //CACHINGPP_NODE_POOL_H
@@ -0,0 +1,377 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_PREFETCHING_CACHE_H
+#define CACHINGPP_PREFETCHING_CACHE_H
+
+
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <type_traits>
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <unordered_set>
+#include "cache.h"
+
+
+// Detects sequential and strided key streams on the miss path of a policy and
+// loads the next keys of a stream ahead of time on a pool of background threads.
+// Streams are tracked per thread unless the thread picks a stream id itself.
+template <typename Key, typename Value, typename EntryAlloc,
+          template <typename, typename, typename...> class Policy>
+class PrefetchingCache : public BaseCache<Key, Value, EntryAlloc>
+{
+    static_assert(std::is_integral<Key>::value, "PrefetchingCache needs integral keys to detect strides");
+
+    using Stride = typename std::make_signed<Key>::type;
+    using Distance = typename std::make_unsigned<Key>::type;
+
+    struct Stream
+    {
+        Key last_key;
+        Stride stride;
+        size_t confirmations;
+        size_t prefetched_ahead;    // strides past last_key already queued
+        uint64_t last_used;
+    };
+
+    static const size_t STREAMS_PER_ID = 4;
+    static const size_t MAX_STREAM_IDS = 256;
+    static const size_t MAX_PENDING_KEYS = 4096;
+
+    // a few streams per id, so interleaved scans and random keys do not reset each other
+    struct StreamTable
+    {
+        Stream streams[STREAMS_PER_ID];
+        uint64_t last_used;
+    };
+
+public:
+    explicit
+    PrefetchingCache(size_t capacity, size_t prefetch_depth = 8, size_t prefetch_threads = 4,
+                     size_t confirmations_needed = 2, size_t max_stride = 64)
+            : policy_(capacity),
+              entry_alloc_(),
+              prefetch_depth_(prefetch_depth),
+              confirmations_needed_(confirmations_needed),
+              max_stride_(max_stride),
+              streams_(),
+              streams_clock_(0),
+              pending_keys_(),
+              queued_keys_(),
+              stopped_(false),
+              prefetch_issued_(0),
+              prefetch_inserted_(0)
+    {
+        policy_.set_miss_handler([this] (Key const& key)
+                                 {
+                                     on_miss(key);
+                                 });
+        for (size_t i = 0; i < prefetch_threads; ++i)
+        {
+            workers_.emplace_back([this, prefetch_threads] ()
+                                  {
+                                      prefetch_loop(std::max((size_t) 1, prefetch_depth_ / prefetch_threads));
+                                  });
+        }
+    }
+
+    ~PrefetchingCache() override
+    {
+        {
+            std::lock_guard<std::mutex> lck {queue_mtx_};
+            stopped_ = true;
+        }
+        queue_cv_.notify_all();
+        for (auto & worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    Value get(Key const& key) override
+    {
+        return policy_.get(key);
+    }
+
+    bool find(Key const& key, Value& value) override
+    {
+        return policy_.find(key, value);
+    }
+
+    void put(Key const& key, Value value) override
+    {
+        policy_.put(key, std::move(value));
+    }
+
+    bool erase(Key const& key) override
+    {
+        return policy_.erase(key);
+    }
+
+    size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) override
+    {
+        return policy_.invalidate_if(predicate);
+    }
+
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        policy_.record_accesses(keys);
+    }
+
+    bool check_cache_presence(Key const& key) override
+    {
+        return policy_.check_cache_presence(key);
+    }
+
+    uint64_t get_cache_misses() const override
+    {
+        return policy_.get_cache_misses();
+    }
+
+    size_t size() override
+    {
+        return policy_.size();
+    }
+
+    std::string name() const override
+    {
+        return policy_.name() + "+prefetch";
+    }
+
+    // streams of the calling thread are tracked under this id from now on
+    static void set_stream_id(uint64_t stream_id)
+    {
+        current_stream_id() = stream_id;
+    }
+
+    uint64_t get_prefetch_issued() const
+    {
+        return prefetch_issued_;
+    }
+
+    uint64_t get_prefetch_inserted() const
+    {
+        return prefetch_inserted_;
+    }
+
+    uint64_t get_prefetch_hits() const
+    {
+        return policy_.get_prefetch_hits();
+    }
+
+    // share of prefetched entries that were used before eviction
+    double get_prefetch_accuracy() const
+    {
+        return prefetch_inserted_ ? (double) get_prefetch_hits() / prefetch_inserted_ : 0;
+    }
+
+    // share of would-be misses that prefetching turned into hits
+    double get_prefetch_coverage() const
+    {
+        uint64_t hits = get_prefetch_hits();
+        return hits ? (double) hits / (hits + get_cache_misses()) : 0;
+    }
+
+private:
+    Policy<Key, Value, EntryAlloc> policy_;
+    EntryAlloc entry_alloc_;
+
+    size_t prefetch_depth_;
+    size_t confirmations_needed_;
+    Stride max_stride_;
+    std::unordered_map<uint64_t, StreamTable> streams_;
+    uint64_t streams_clock_;
+
+    std::deque<Key> pending_keys_;
+    std::unordered_set<Key> queued_keys_;
+    bool stopped_;
+    std::mutex queue_mtx_;
+    std::condition_variable queue_cv_;
+    std::vector<std::thread> workers_;
+
+    std::atomic<uint64_t> prefetch_issued_;
+    std::atomic<uint64_t> prefetch_inserted_;
+
+    static uint64_t& current_stream_id()
+    {
+        static thread_local uint64_t stream_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+        return stream_id;
+    }
+
+    // called by the policy with its lock held, so streams_ needs no lock of its own
+    void on_miss(Key const& key)
+    {
+        StreamTable& table = find_table(current_stream_id());
+        table.last_used = ++streams_clock_;
+        Stream& stream = find_stream(table, key);
+        stream.last_used = streams_clock_;
+
+        Stride stride = distance(stream.last_key, key);
+        if (stride != 0 && stride == stream.stride)
+        {
+            ++stream.confirmations;
+            if (stream.prefetched_ahead > 0)
+            {
+                --stream.prefetched_ahead;
+            }
+        }
+        else
+        {
+            stream.stride = stride;
+            stream.confirmations = 0;
+            stream.prefetched_ahead = 0;
+        }
+        stream.last_key = key;
+
+        if (stream.stride == 0 || stream.confirmations + 1 < confirmations_needed_)
+        {
+            return;
+        }
+
+        // keep prefetch_depth_ keys in flight ahead of the stream, a stream stops at the end of the key range
+        std::vector<Key> keys;
+        size_t ahead = 0;
+        for (Key next = key; ahead < prefetch_depth_ && step(next, stream.stride);)
+        {
+            if (++ahead > stream.prefetched_ahead && !policy_.check_cache_presence(next))
+            {
+                keys.push_back(next);
+            }
+        }
+        stream.prefetched_ahead = ahead;
+        if (keys.empty())
+        {
+            return;
+        }
+
+        size_t queued = 0;
+        {
+            std::lock_guard<std::mutex> lck {queue_mtx_};
+            for (auto const& next : keys)
+            {
+                if (!queued_keys_.insert(next).second)
+                {
+                    continue;
+                }
+                // the oldest keys are the likeliest to be behind their stream already
+                if (pending_keys_.size() == MAX_PENDING_KEYS)
+                {
+                    queued_keys_.erase(pending_keys_.front());
+                    pending_keys_.pop_front();
+                }
+                pending_keys_.push_back(next);
+                ++queued;
+            }
+        }
+        if (queued > 0)
+        {
+            prefetch_issued_ += queued;
+            queue_cv_.notify_all();
+        }
+    }
+
+    // wraps instead of overflowing for signed keys far apart
+    static Stride distance(Key from, Key to)
+    {
+        return (Stride) ((Distance) to - (Distance) from);
+    }
+
+    // moves key by stride unless that leaves the range of Key
+    static bool step(Key& key, Stride stride)
+    {
+        if (stride > 0 ? key > std::numeric_limits<Key>::max() - (Key) stride
+                       : key < std::numeric_limits<Key>::min() + (Key) -stride)
+        {
+            return false;
+        }
+        key += stride;
+        return true;
+    }
+
+    // ids beyond MAX_STREAM_IDS push out the table that missed least recently
+    StreamTable& find_table(uint64_t stream_id)
+    {
+        auto it = streams_.find(stream_id);
+        if (it != streams_.end())
+        {
+            return it->second;
+        }
+        if (streams_.size() >= MAX_STREAM_IDS)
+        {
+            streams_.erase(std::min_element(streams_.begin(), streams_.end(),
+                                            [] (auto const& lhs, auto const& rhs)
+                                            {
+                                                return lhs.second.last_used < rhs.second.last_used;
+                                            }));
+        }
+        return streams_[stream_id];
+    }
+
+    // the stream key continues, or the least recently used one which then starts over from key
+    Stream& find_stream(StreamTable& table, Key const& key)
+    {
+        Stream* victim = &table.streams[0];
+        for (auto & stream : table.streams)
+        {
+            if (stream.last_used == 0)
+            {
+                victim = &stream;
+                continue;
+            }
+            Stride stride = distance(stream.last_key, key);
+            if (stream.confirmations > 0 ? stride == stream.stride
+                                         : stride != 0 && stride <= max_stride_ && stride >= -max_stride_)
+            {
+                return stream;
+            }
+            if (victim->last_used != 0 && stream.last_used < victim->last_used)
+            {
+                victim = &stream;
+            }
+        }
+        *victim = Stream{key, 0, 0, 0, 0};
+        return *victim;
+    }
+
+    void prefetch_loop(size_t keys_per_batch)
+    {
+        std::vector<Key> keys;
+        std::vector<std::pair<Key, Value>> entries;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lck {queue_mtx_};
+                queue_cv_.wait(lck, [this] ()
+                               {
+                                   return stopped_ || !pending_keys_.empty();
+                               });
+                if (stopped_)
+                {
+                    return;
+                }
+                size_t taken = std::min(keys_per_batch, pending_keys_.size());
+                keys.assign(pending_keys_.begin(), pending_keys_.begin() + taken);
+                pending_keys_.erase(pending_keys_.begin(), pending_keys_.begin() + taken);
+                for (auto const& key : keys)
+                {
+                    queued_keys_.erase(key);
+                }
+            }
+
+            entries.clear();
+            for (auto const& key : keys)
+            {
+                entries.emplace_back(key, entry_alloc_(key));
+            }
+            keys.clear();
+            prefetch_inserted_ += policy_.insert_prefetched(entries);
+        }
+    }
+};
+
+
+#endif //CACHINGPP_PREFETCHING_CACHE_H
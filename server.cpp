@@ -0,0 +1,109 @@
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include "memcached_server.h"
+#include "front_cache.h"
+#include "command_line.h"
+
+
+using ServedCache = BaseCache<StringKey, MemcachedItemPtr, AbsentItems>;
+
+std::map<std::string, std::string> OPTIONS = {
+        {"host", "127.0.0.1"},
+        {"port", "11211"},          // "off" serves the Unix socket only
+        {"socket", ""},
+        {"threads", "4"},
+        {"policy", "car"},          // car, lru, front+car or front+lru
+        {"capacity", "1048576"},
+        {"max_item_size", "1048576"},
+};
+
+std::unique_ptr<ServedCache> make_cache(std::string const& policy, size_t capacity)
+{
+    std::string policy_name = policy;
+    bool front = policy_name.compare(0, 6, "front+") == 0;
+    if (front)
+    {
+        policy_name = policy_name.substr(6);
+    }
+
+    std::unique_ptr<ServedCache> cache;
+    if (policy_name == "car")
+    {
+        cache = std::make_unique<CarCache<StringKey, MemcachedItemPtr, AbsentItems>>(capacity);
+    }
+    else if (policy_name == "lru")
+    {
+        cache = std::make_unique<LruCache<StringKey, MemcachedItemPtr, AbsentItems>>(capacity);
+    }
+    else
+    {
+        throw std::invalid_argument("unknown policy " + policy);
+    }
+
+    if (front)
+    {
+        cache = std::make_unique<FrontCache<StringKey, MemcachedItemPtr, AbsentItems>>(std::move(cache));
+    }
+    return cache;
+}
+
+int main(int argc, char** argv)
+{
+    if (!parse_options(argc, argv, OPTIONS))
+    {
+        print_usage(argv[0], OPTIONS);
+        return 1;
+    }
+
+    // reactors inherit the mask, the signals are only taken by sigwait below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    if (OPTIONS.at("port") == "off" && OPTIONS.at("socket").empty())
+    {
+        std::cerr << "nothing to listen on\n";
+        return 1;
+    }
+
+    try
+    {
+        auto cache = make_cache(OPTIONS.at("policy"), std::stoull(OPTIONS.at("capacity")));
+        MemcachedServer<AbsentItems> server(*cache, std::stoull(OPTIONS.at("threads")),
+                                            std::stoull(OPTIONS.at("max_item_size")));
+
+        std::cout << "serving " << cache->name() << " with " << OPTIONS.at("threads") << " reactors on";
+        if (OPTIONS.at("port") != "off")
+        {
+            server.listen_tcp(OPTIONS.at("host"), std::stoul(OPTIONS.at("port")));
+            std::cout << " " << OPTIONS.at("host") << ":" << server.get_tcp_port();
+        }
+        if (!OPTIONS.at("socket").empty())
+        {
+            server.listen_unix(OPTIONS.at("socket"));
+            std::cout << " " << OPTIONS.at("socket");
+        }
+        std::cout << std::endl;
+
+        server.start();
+        int signal = 0;
+        sigwait(&signals, &signal);
+        server.stop();
+
+        std::cout << "connections: " << server.get_connections()
+                  << " requests: " << server.get_requests()
+                  << " hits: " << server.get_hits()
+                  << " misses: " << server.get_misses()
+                  << " cache size: " << cache->size()
+                  << "\n";
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_STRING_KEY_H
+#define CACHINGPP_STRING_KEY_H
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <string_view>
+
+
+// String cache key with its hash computed once, at construction.
+// A key built from a string_view, std::string or C string only borrows the caller's
+// bytes, so lookups neither allocate nor rehash. The caches call persist_key() before
+// storing a key: the bytes are then copied once into a shared block, and every copy
+// kept by the index, the recency lists and removal notifications points into it.
+class StringKey
+{
+    struct Block
+    {
+        std::atomic<size_t> references;
+        char chars[1];
+    };
+
+public:
+    StringKey()
+            : StringKey(std::string_view())
+    {}
+
+    StringKey(std::string_view view)
+            : block_(nullptr),
+              data_(view.data()),
+              size_(view.size()),
+              hash_(std::hash<std::string_view>()(view))
+    {}
+
+    explicit
+    StringKey(std::string const& string)
+            : StringKey(std::string_view(string))
+    {}
+
+    // a temporary string would be gone before the key that borrows it
+    StringKey(std::string&&) = delete;
+
+    explicit
+    StringKey(char const* string)
+            : StringKey(std::string_view(string))
+    {}
+
+    StringKey(StringKey const& other)
+            : block_(other.block_),
+              data_(other.data_),
+              size_(other.size_),
+              hash_(other.hash_)
+    {
+        if (block_)
+        {
+            block_->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    StringKey(StringKey&& other) noexcept
+            : block_(other.block_),
+              data_(other.data_),
+              size_(other.size_),
+              hash_(other.hash_)
+    {
+        other.block_ = nullptr;
+    }
+
+    StringKey& operator=(StringKey other) noexcept
+    {
+        std::swap(block_, other.block_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(hash_, other.hash_);
+        return *this;
+    }
+
+    ~StringKey()
+    {
+        if (block_ && block_->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            block_->~Block();
+            ::operator delete(block_);
+        }
+    }
+
+    // an owning copy sharing the stored bytes, or a new block for a borrowed key
+    StringKey persist() const
+    {
+        if (block_)
+        {
+            return *this;
+        }
+
+        void* memory = ::operator new(offsetof(Block, chars) + size_ + 1);
+        auto block = new (memory) Block{{1}, {0}};
+        if (size_ != 0)
+        {
+            std::memcpy(block->chars, data_, size_);
+        }
+        block->chars[size_] = '\0';
+        return StringKey(block, size_, hash_);
+    }
+
+    bool owns_bytes() const
+    {
+        return block_ != nullptr;
+    }
+
+    std::string_view view() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+    char const* data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t hash() const
+    {
+        return hash_;
+    }
+
+    friend bool operator==(StringKey const& lhs, StringKey const& rhs)
+    {
+        return lhs.hash_ == rhs.hash_ && (lhs.data_ == rhs.data_ ? lhs.size_ == rhs.size_ : lhs.view() == rhs.view());
+    }
+
+    friend bool operator!=(StringKey const& lhs, StringKey const& rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+private:
+    Block* block_;
+    char const* data_;
+    size_t size_;
+    size_t hash_;
+
+    StringKey(Block* block, size_t size, size_t hash)
+            : block_(block),
+              data_(block->chars),
+              size_(size),
+              hash_(hash)
+    {}
+};
+
+
+inline StringKey persist_key(StringKey const& key)
+{
+    return key.persist();
+}
+
+
+namespace std
+{
+    template <>
+    struct hash<StringKey>
+    {
+        size_t operator()(StringKey const& key) const
+        {
+            return key.hash();
+        }
+    };
+}
+
+
+#endif //CACHINGPP_STRING_KEY_H
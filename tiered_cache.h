@@ -0,0 +1,389 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_TIERED_CACHE_H
+#define CACHINGPP_TIERED_CACHE_H
+
+
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+#include "cache.h"
+#include "mapped_log.h"
+
+
+// In-memory policy (L1) backed by a memory-mapped log (L2).
+// Entries evicted from L1 are demoted to L2 in batches, L1 misses look into L2
+// before falling back to EntryAlloc. L2 hits are served from the log and promoted
+// to L1 in batches. L2 is inclusive: promoted entries stay in the log, so demoting
+// them again costs nothing.
+// L1 demotes under its lock, so a key never goes missing from both tiers on its way
+// down. put(), erase() and invalidate_if() are serialized and values carry the
+// version of the put() they came from, so put() drops only older copies from L2.
+template <typename Key, typename Value, typename EntryAlloc,
+          template <typename, typename, typename...> class L1Policy>
+class TieredCache : public BaseCache<Key, Value, EntryAlloc>
+{
+    struct Record
+    {
+        Value value;
+        uint64_t version;       // 0 for values loaded from EntryAlloc
+    };
+
+    using RecordPredicate = std::function<bool (Key const&, Record const&)>;
+
+    class LowerTierLoader
+    {
+    public:
+        explicit
+        LowerTierLoader(TieredCache* owner)
+                : owner_(owner)
+        {}
+
+        Record operator() (Key const& key) const
+        {
+            return owner_->load_from_lower_tiers(key);
+        }
+
+    private:
+        TieredCache* owner_;
+    };
+
+public:
+    enum Tier
+    {
+        L1 = 0,
+        L2 = 1,
+        BACKEND = 2,
+        TIERS_COUNT = 3
+    };
+
+    TieredCache(size_t l1_capacity, std::string const& l2_path,
+                size_t l2_segments_count, size_t l2_segment_records, size_t demotion_batch_size = 256,
+                size_t promotion_batch_size = 64)
+            : l1_(l1_capacity, LowerTierLoader(this)),
+              l2_(l2_path, l2_segments_count, l2_segment_records),
+              entry_alloc_(),
+              demotion_batch_size_(demotion_batch_size),
+              pending_demotions_(),
+              pending_demotions_count_(0),
+              promotion_batch_size_(promotion_batch_size),
+              pending_promotions_(),
+              last_version_(0),
+              fence_()
+    {
+        for (size_t i = 0; i < TIERS_COUNT; ++i)
+        {
+            tier_hits_[i] = 0;
+            tier_nanos_[i] = 0;
+        }
+        pending_demotions_.reserve(demotion_batch_size_);
+        pending_promotions_.reserve(promotion_batch_size_);
+        l1_.set_removal_listener([this] (std::vector<RemovalNotification<Key, Record>>& removals)
+                                 {
+                                     demote(removals);
+                                 }, 0);
+    }
+
+    Value get(Key const& key) override
+    {
+        auto start_time = std::chrono::steady_clock::now();
+
+        Record record;
+        Tier tier = L1;
+        std::vector<Key> promotions;
+        if (!l1_.find(key, record))
+        {
+            tier = L2;
+            if (!find_in_l2(key, record, promotions))
+            {
+                served_by() = L1;
+                record = l1_.get(key);
+                tier = served_by();
+            }
+        }
+        if (!promotions.empty())
+        {
+            l1_.load_all(promotions);
+        }
+        flush_demotions(false);
+
+        auto end_time = std::chrono::steady_clock::now();
+        ++tier_hits_[tier];
+        tier_nanos_[tier] += std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
+        return record.value;
+    }
+
+    // L2 hits are not promoted to L1
+    bool find(Key const& key, Value& value) override
+    {
+        Record record;
+        if (l1_.find(key, record))
+        {
+            value = std::move(record.value);
+            return true;
+        }
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        if (find_latest(key, record))
+        {
+            value = record.value;
+            return true;
+        }
+        return false;
+    }
+
+    // an eviction of the new value may already be demoted when the older copies go
+    void put(Key const& key, Value value) override
+    {
+        std::lock_guard<std::mutex> write_lck {write_mtx_};
+        uint64_t version = ++last_version_;
+        l1_.put(key, Record{std::move(value), version});
+
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        drop_from_l2(key, version);
+    }
+
+    bool erase(Key const& key) override
+    {
+        std::lock_guard<std::mutex> write_lck {write_mtx_};
+        bool dropped = false;
+        {
+            std::lock_guard<std::mutex> lck {l2_mtx_};
+            fence_ = [&key] (Key const& demoted, Record const&)
+            {
+                return demoted == key;
+            };
+            dropped = drop_from_l2(key, ++last_version_);
+        }
+        bool erased = l1_.erase(key);
+        lift_fence();
+        return erased || dropped;
+    }
+
+    size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) override
+    {
+        auto matches = [&predicate] (Key const& key, Record const& record)
+        {
+            return predicate(key, record.value);
+        };
+
+        std::lock_guard<std::mutex> write_lck {write_mtx_};
+        std::unordered_set<Key> dropped;
+        {
+            std::lock_guard<std::mutex> lck {l2_mtx_};
+            fence_ = matches;
+            drop_from_l2(matches, dropped);
+        }
+        // L2 is inclusive, a key invalidated in both tiers counts once
+        size_t invalidated_in_l1_only = 0;
+        l1_.invalidate_if([&matches, &dropped, &invalidated_in_l1_only] (Key const& key, Record const& record)
+                          {
+                              if (!matches(key, record))
+                              {
+                                  return false;
+                              }
+                              invalidated_in_l1_only += dropped.count(key) == 0;
+                              return true;
+                          });
+        lift_fence();
+        return dropped.size() + invalidated_in_l1_only;
+    }
+
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        l1_.record_accesses(keys);
+    }
+
+    bool check_cache_presence(Key const& key) override
+    {
+        return l1_.check_cache_presence(key);
+    }
+
+    uint64_t get_cache_misses() const override
+    {
+        return tier_hits_[BACKEND];
+    }
+
+    size_t size() override
+    {
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        return l1_.size() + l2_.size();
+    }
+
+    std::string name() const override
+    {
+        return l1_.name() + "+L2";
+    }
+
+    uint64_t get_tier_hits(Tier tier) const
+    {
+        return tier_hits_[tier];
+    }
+
+    std::chrono::nanoseconds get_tier_time(Tier tier) const
+    {
+        return std::chrono::nanoseconds{tier_nanos_[tier].load()};
+    }
+
+    void flush_demotions()
+    {
+        flush_demotions(true);
+    }
+
+private:
+    L1Policy<Key, Record, LowerTierLoader> l1_;
+    MappedLogStore<Key, Record> l2_;
+    EntryAlloc entry_alloc_;
+
+    size_t demotion_batch_size_;
+    std::unordered_map<Key, Record> pending_demotions_;     // newer than the L2 records of their keys
+    std::atomic<size_t> pending_demotions_count_;
+    size_t promotion_batch_size_;
+    std::vector<Key> pending_promotions_;
+    uint64_t last_version_;
+    RecordPredicate fence_;     // set while erase() or invalidate_if() clear both tiers, keeps demotions out
+    std::mutex write_mtx_;
+    std::mutex l2_mtx_;
+
+    std::atomic<uint64_t> tier_hits_[TIERS_COUNT];
+    std::atomic<uint64_t> tier_nanos_[TIERS_COUNT];
+
+    static Tier& served_by()
+    {
+        static thread_local Tier tier = L1;
+        return tier;
+    }
+
+    // called by L1 with its lock held, a key missing from L1 is either in L2 or not cached at all
+    Record load_from_lower_tiers(Key const& key)
+    {
+        {
+            std::lock_guard<std::mutex> lck {l2_mtx_};
+            Record record;
+            if (find_latest(key, record))
+            {
+                served_by() = L2;
+                return record;
+            }
+        }
+
+        served_by() = BACKEND;
+        return Record{entry_alloc_(key), 0};
+    }
+
+    // called with l2_mtx_ held
+    bool find_latest(Key const& key, Record& record)
+    {
+        auto pending = pending_demotions_.find(key);
+        if (pending != pending_demotions_.end())
+        {
+            record = pending->second;
+            return true;
+        }
+        return l2_.find(key, record);
+    }
+
+    // L2 hits reach L1 once promotion_batch_size_ of them piled up, the caller promotes a full batch
+    bool find_in_l2(Key const& key, Record& record, std::vector<Key>& promotions)
+    {
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        if (!find_latest(key, record))
+        {
+            return false;
+        }
+        pending_promotions_.push_back(key);
+        if (pending_promotions_.size() >= promotion_batch_size_)
+        {
+            promotions.swap(pending_promotions_);
+            pending_promotions_.reserve(promotion_batch_size_);
+        }
+        return true;
+    }
+
+    // called by L1 with its lock held; a promoted entry that was not written meanwhile is already in L2
+    void demote(std::vector<RemovalNotification<Key, Record>> const& removals)
+    {
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        for (auto const& removal : removals)
+        {
+            if (removal.cause != RemovalCause::CAPACITY || (fence_ && fence_(removal.key, removal.value)))
+            {
+                continue;
+            }
+            Record latest;
+            if (find_latest(removal.key, latest) && latest.version >= removal.value.version)
+            {
+                continue;
+            }
+            pending_demotions_[removal.key] = removal.value;
+            pending_demotions_count_ = pending_demotions_.size();
+        }
+    }
+
+    // drops copies older than version, called with l2_mtx_ held
+    bool drop_from_l2(Key const& key, uint64_t version)
+    {
+        bool dropped = false;
+        auto pending = pending_demotions_.find(key);
+        if (pending != pending_demotions_.end() && pending->second.version < version)
+        {
+            pending_demotions_.erase(pending);
+            pending_demotions_count_ = pending_demotions_.size();
+            dropped = true;
+        }
+
+        Record record;
+        if (l2_.find(key, record) && record.version < version)
+        {
+            l2_.erase(key);
+            dropped = true;
+        }
+        return dropped;
+    }
+
+    // called with l2_mtx_ held
+    void drop_from_l2(RecordPredicate const& predicate, std::unordered_set<Key>& dropped)
+    {
+        auto matches = [&predicate, &dropped] (Key const& key, Record const& record)
+        {
+            if (!predicate(key, record))
+            {
+                return false;
+            }
+            dropped.insert(key);
+            return true;
+        };
+
+        for (auto it = pending_demotions_.begin(); it != pending_demotions_.end();)
+        {
+            it = matches(it->first, it->second) ? pending_demotions_.erase(it) : std::next(it);
+        }
+        pending_demotions_count_ = pending_demotions_.size();
+        l2_.erase_if(matches);
+    }
+
+    void lift_fence()
+    {
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        fence_ = nullptr;
+    }
+
+    void flush_demotions(bool force)
+    {
+        if (!force && pending_demotions_count_ < demotion_batch_size_)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lck {l2_mtx_};
+        l2_.append(pending_demotions_.begin(), pending_demotions_.end());
+        pending_demotions_.clear();
+        pending_demotions_count_ = 0;
+    }
+};
+
+
+#endif //CACHINGPP_TIERED_CACHE_H
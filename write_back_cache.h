@@ -0,0 +1,325 @@
+//
+// Created by student on 18.10.26.
+//
+
+#ifndef CACHINGPP_WRITE_BACK_CACHE_H
+#define CACHINGPP_WRITE_BACK_CACHE_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include "cache.h"
+
+
+// Write-back mode over any policy: put() only marks the key dirty, the latest value
+// of each dirty key reaches Writer once the key leaves the cache, when enough of
+// them piled up, on the flush timer, or on flush(). Repeated writes to a key
+// between flushes collapse into a single backend write.
+// Policy misses see dirty values that have not reached Writer yet before EntryAlloc.
+// Writer is called with std::vector<std::pair<Key, Value>> and never concurrently.
+template <typename Key, typename Value, typename EntryAlloc, typename Writer,
+          template <typename, typename, typename...> class Policy>
+class WriteBackCache : public BaseCache<Key, Value, EntryAlloc>
+{
+    using WriteBatch = std::vector<std::pair<Key, Value>>;
+
+    class DirtyLoader
+    {
+    public:
+        explicit
+        DirtyLoader(WriteBackCache* owner)
+                : owner_(owner)
+        {}
+
+        Value operator() (Key const& key) const
+        {
+            return owner_->load(key);
+        }
+
+    private:
+        WriteBackCache* owner_;
+    };
+
+public:
+    // a zero flush_interval disables the timer
+    explicit
+    WriteBackCache(size_t capacity, size_t write_batch_size = 64,
+                   std::chrono::milliseconds flush_interval = std::chrono::milliseconds{0})
+            : WriteBackCache(capacity, Writer(), write_batch_size, flush_interval)
+    {}
+
+    WriteBackCache(size_t capacity, Writer writer, size_t write_batch_size,
+                   std::chrono::milliseconds flush_interval)
+            : policy_(capacity, DirtyLoader(this)),
+              entry_alloc_(),
+              writer_(std::move(writer)),
+              write_batch_size_(write_batch_size),
+              flush_interval_(flush_interval),
+              dirty_(),
+              evicted_dirty_(),
+              writing_(),
+              stopped_(false),
+              puts_(0),
+              written_entries_(0),
+              writer_calls_(0)
+    {
+        policy_.set_removal_listener([this] (std::vector<RemovalNotification<Key, Value>>& removals)
+                                     {
+                                         on_removals(removals);
+                                     });
+        if (flush_interval_.count() > 0)
+        {
+            timer_ = std::thread([this] ()
+                                 {
+                                     flush_loop();
+                                 });
+        }
+    }
+
+    ~WriteBackCache() override
+    {
+        if (timer_.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lck {dirty_mtx_};
+                stopped_ = true;
+            }
+            timer_cv_.notify_one();
+            timer_.join();
+        }
+        flush();
+    }
+
+    Value get(Key const& key) override
+    {
+        return policy_.get(key);
+    }
+
+    // dirty values that already left the policy are found, but not admitted again
+    bool find(Key const& key, Value& value) override
+    {
+        return policy_.find(key, value) || find_dirty(key, value);
+    }
+
+    // puts are serialized, so the policy and dirty_ agree on which one came last
+    void put(Key const& key, Value value) override
+    {
+        std::lock_guard<std::mutex> put_lck {put_mtx_};
+        ++puts_;
+        {
+            std::lock_guard<std::mutex> lck {dirty_mtx_};
+            auto dirty = dirty_.find(key);
+            if (dirty != dirty_.end())
+            {
+                dirty->second = value;
+            }
+            else
+            {
+                dirty_.emplace(persist_key(key), value);
+            }
+        }
+        policy_.put(key, std::move(value));
+    }
+
+    // a dirty key is written before it is dropped
+    bool erase(Key const& key) override
+    {
+        bool erased = policy_.erase(key);
+        write_evicted(false);
+        return erased;
+    }
+
+    size_t invalidate_if(InvalidationPredicate<Key, Value> const& predicate) override
+    {
+        size_t invalidated = policy_.invalidate_if(predicate);
+        write_evicted(false);
+        return invalidated;
+    }
+
+    void record_accesses(std::vector<Key> const& keys) override
+    {
+        policy_.record_accesses(keys);
+    }
+
+    bool check_cache_presence(Key const& key) override
+    {
+        return policy_.check_cache_presence(key);
+    }
+
+    uint64_t get_cache_misses() const override
+    {
+        return policy_.get_cache_misses();
+    }
+
+    size_t size() override
+    {
+        return policy_.size();
+    }
+
+    std::string name() const override
+    {
+        return policy_.name() + "+write-back";
+    }
+
+    // writes every dirty entry, resident or not
+    void flush()
+    {
+        policy_.flush_removals();
+
+        std::lock_guard<std::mutex> writer_lck {writer_mtx_};
+        {
+            std::lock_guard<std::mutex> lck {dirty_mtx_};
+            writing_.swap(evicted_dirty_);
+            for (auto & dirty : dirty_)
+            {
+                writing_.emplace_back(dirty.first, std::move(dirty.second));
+            }
+            dirty_.clear();
+        }
+        write();
+    }
+
+    uint64_t get_puts() const
+    {
+        return puts_;
+    }
+
+    uint64_t get_written_entries() const
+    {
+        return written_entries_;
+    }
+
+    uint64_t get_writer_calls() const
+    {
+        return writer_calls_;
+    }
+
+private:
+    Policy<Key, Value, DirtyLoader> policy_;
+    EntryAlloc entry_alloc_;
+    Writer writer_;
+    size_t write_batch_size_;
+    std::chrono::milliseconds flush_interval_;
+
+    std::unordered_map<Key, Value> dirty_;
+    WriteBatch evicted_dirty_;
+    WriteBatch writing_;        // the batch Writer is busy with, read-only until it returns
+    bool stopped_;
+    std::mutex put_mtx_;        // taken before the policy lock and dirty_mtx_
+    std::mutex dirty_mtx_;
+    std::mutex writer_mtx_;
+    std::condition_variable timer_cv_;
+    std::thread timer_;
+
+    std::atomic<uint64_t> puts_;
+    std::atomic<uint64_t> written_entries_;
+    std::atomic<uint64_t> writer_calls_;
+
+    // called by the policy with its lock held; a key can be dirty and not resident while
+    // its removal waits for delivery, for a full write batch or for Writer to finish
+    Value load(Key const& key)
+    {
+        Value value;
+        if (find_dirty(key, value))
+        {
+            return value;
+        }
+        return entry_alloc_(key);
+    }
+
+    bool find_dirty(Key const& key, Value& value)
+    {
+        std::lock_guard<std::mutex> lck {dirty_mtx_};
+        auto dirty = dirty_.find(key);
+        if (dirty != dirty_.end())
+        {
+            value = dirty->second;
+            return true;
+        }
+        for (WriteBatch const* batch : {&evicted_dirty_, &writing_})
+        {
+            auto written = std::find_if(batch->rbegin(), batch->rend(),
+                                        [&key] (std::pair<Key, Value> const& entry)
+                                        {
+                                            return entry.first == key;
+                                        });
+            if (written != batch->rend())
+            {
+                value = written->second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // the latest dirty value is written, whatever value the removal carries
+    void on_removals(std::vector<RemovalNotification<Key, Value>> const& removals)
+    {
+        {
+            std::lock_guard<std::mutex> lck {dirty_mtx_};
+            for (auto const& removal : removals)
+            {
+                auto dirty = dirty_.find(removal.key);
+                if (dirty != dirty_.end())
+                {
+                    evicted_dirty_.emplace_back(dirty->first, std::move(dirty->second));
+                    dirty_.erase(dirty);
+                }
+            }
+        }
+        write_evicted(true);
+    }
+
+    void write_evicted(bool full_batches_only)
+    {
+        std::lock_guard<std::mutex> writer_lck {writer_mtx_};
+        {
+            std::lock_guard<std::mutex> lck {dirty_mtx_};
+            if (evicted_dirty_.size() >= write_batch_size_ || (!full_batches_only && !evicted_dirty_.empty()))
+            {
+                writing_.swap(evicted_dirty_);
+            }
+        }
+        write();
+    }
+
+    // called with writer_mtx_ held, so batches reach the writer in order
+    void write()
+    {
+        if (writing_.empty())
+        {
+            return;
+        }
+        writer_(writing_);
+        ++writer_calls_;
+        written_entries_ += writing_.size();
+
+        std::lock_guard<std::mutex> lck {dirty_mtx_};
+        writing_.clear();
+    }
+
+    void flush_loop()
+    {
+        std::unique_lock<std::mutex> lck {dirty_mtx_};
+        while (!stopped_)
+        {
+            timer_cv_.wait_for(lck, flush_interval_, [this] ()
+                               {
+                                   return stopped_;
+                               });
+            if (stopped_)
+            {
+                return;
+            }
+            lck.unlock();
+            flush();
+            lck.lock();
+        }
+    }
+};
+
+
+#endif //CACHINGPP_WRITE_BACK_CACHE_H